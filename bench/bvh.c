@@ -0,0 +1,182 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "plat/core.h"
+/* for load_obj, as the game loads its meshes */
+#include "game/asset.c"
+
+/* Ray casts into the game meshes: the bvh of room.obj and rock.obj is
+ * built as the asset loader does, then random rays aimed at the mesh are
+ * cast through it and against every triangle, Moller-Trumbore as the
+ * bvh leaves do. Both must find the same nearest hits. */
+
+#define RAY_COUNT 20000
+#define REPEAT    5
+
+static const char *const meshes[] = {
+	"res/room.obj",
+	"res/rock.obj",
+};
+
+struct ray {
+	vec3 org, dir;
+};
+
+static float
+randf(void)
+{
+	return rand() / (float) RAND_MAX * 2 - 1;
+}
+
+static int
+read_obj(struct memory_zone *zone, const char *path, struct obj_data *obj)
+{
+	struct asset_file file = { 0 };
+
+	file.name = path;
+	file.size = file_size(path);
+	if (file.size <= 0)
+		return -1;
+	file.data = mempush(zone, file.size + 1);
+	if (file_read(path, file.data, file.size) != file.size)
+		return -1;
+	file.data[file.size] = '\0';
+	load_obj(zone, &file, obj);
+
+	return 0;
+}
+
+/* nearest hit of every triangle, as bvh_triangle_intersect */
+static int
+brute_intersect(const struct obj_data *obj, vec3 org, vec3 dir, float *t)
+{
+	const vec3 *pos = (const vec3 *) obj->positions;
+	vec3 v0, e1, e2, p, s, q;
+	float det, inv, u, v, d;
+	int hit = 0;
+	size_t i;
+
+	for (i = 0; i < obj->index_count; i += 3) {
+		v0 = pos[obj->indices[i]];
+		e1 = vec3_sub(pos[obj->indices[i + 1]], v0);
+		e2 = vec3_sub(pos[obj->indices[i + 2]], v0);
+		p = vec3_cross(dir, e2);
+		det = vec3_dot(e1, p);
+		if (fabsf(det) < 1e-12f)
+			continue;
+		inv = 1 / det;
+		s = vec3_sub(org, v0);
+		u = vec3_dot(s, p) * inv;
+		if (u < 0 || u > 1)
+			continue;
+		q = vec3_cross(s, e1);
+		v = vec3_dot(dir, q) * inv;
+		if (v < 0 || u + v > 1)
+			continue;
+		d = vec3_dot(e2, q) * inv;
+		if (d < 0 || d >= *t)
+			continue;
+		*t = d;
+		hit = 1;
+	}
+
+	return hit;
+}
+
+/* from a sphere around the mesh, to a point of its bounds */
+static void
+make_rays(const struct obj_data *obj, struct ray *rays)
+{
+	const vec3 *pos = (const vec3 *) obj->positions;
+	vec3 min = pos[0], max = pos[0], center, extent, to;
+	float radius;
+	size_t i;
+
+	for (i = 1; i < obj->vertex_count; i++) {
+		min = (vec3){ MIN(min.x, pos[i].x), MIN(min.y, pos[i].y), MIN(min.z, pos[i].z) };
+		max = (vec3){ MAX(max.x, pos[i].x), MAX(max.y, pos[i].y), MAX(max.z, pos[i].z) };
+	}
+	center = vec3_mult(0.5f, vec3_add(min, max));
+	extent = vec3_mult(0.5f, vec3_sub(max, min));
+	radius = 2 * vec3_norm(extent);
+
+	for (i = 0; i < RAY_COUNT; i++) {
+		rays[i].org = vec3_normalize((vec3){ randf(), randf(), randf() });
+		rays[i].org = vec3_add(center, vec3_mult(radius, rays[i].org));
+		to = (vec3){ randf() * extent.x, randf() * extent.y, randf() * extent.z };
+		rays[i].dir = vec3_sub(vec3_add(center, to), rays[i].org);
+	}
+}
+
+static int
+bench_mesh(struct memory_zone *zone, const char *path, struct ray *rays, float *dist)
+{
+	struct memory_zone mem_state = *zone;
+	struct obj_data obj;
+	struct bvh bvh;
+	double start, build, brute = 1e9, cast = 1e9;
+	unsigned int hits = 0, wrong = 0;
+	size_t i;
+	int repeat;
+	float t;
+
+	if (read_obj(zone, path, &obj) < 0) {
+		printf("bvh: %s: cannot be read\n", path);
+		return 1;
+	}
+	start = job_time();
+	bvh_build(&bvh, zone, obj.positions, sizeof(vec3), obj.indices, obj.index_count);
+	build = job_time() - start;
+	make_rays(&obj, rays);
+
+	for (repeat = 0; repeat < REPEAT; repeat++) {
+		start = job_time();
+		for (i = 0; i < RAY_COUNT; i++) {
+			dist[i] = INFINITY;
+			brute_intersect(&obj, rays[i].org, rays[i].dir, &dist[i]);
+		}
+		brute = MIN(brute, job_time() - start);
+
+		start = job_time();
+		for (i = 0, hits = wrong = 0; i < RAY_COUNT; i++) {
+			t = INFINITY;
+			hits += bvh_intersect(&bvh, rays[i].org, rays[i].dir, &t);
+			if (t != dist[i] && !(fabsf(t - dist[i]) <= 1e-5f * MAX(1, dist[i])))
+				wrong++;
+		}
+		cast = MIN(cast, job_time() - start);
+	}
+	*zone = mem_state;
+
+	printf("bvh: %-12s %5zu triangles, %4u nodes, build %.2f ms, %5.1f us/ray brute force, "
+	       "%.2f us/ray, %.1f Mrays/s, %u hits\n",
+	       path, obj.index_count / 3, bvh.node_count, build * 1e3, brute / RAY_COUNT * 1e6,
+	       cast / RAY_COUNT * 1e6, RAY_COUNT / cast / 1e6, hits);
+	if (wrong)
+		printf("bvh: %s: %u rays differ from the brute force\n", path, wrong);
+
+	return wrong != 0;
+}
+
+int
+main(void)
+{
+	struct memory_zone zone;
+	struct ray *rays;
+	float *dist;
+	size_t i;
+	int err = 0;
+
+	zone.base = xvmalloc(NULL, SZ_4M, SZ_16M);
+	zone.size = SZ_16M;
+	zone.used = 0;
+	rays = mempush(&zone, RAY_COUNT * sizeof(*rays));
+	dist = mempush(&zone, RAY_COUNT * sizeof(*dist));
+
+	srand(1);
+	for (i = 0; i < ARRAY_LEN(meshes); i++)
+		err |= bench_mesh(&zone, meshes[i], rays, dist);
+
+	return err;
+}
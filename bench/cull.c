@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine/engine.h"
+#include "plat/core.h"
+
+/* Frustum culling of 10k to 1M entities, one sphere at a time with
+ * sphere_outside_frustum as the entity loop did, then four at a time with
+ * spheres_in_frustum on the entity arrays. Both must find the same
+ * visible entities. */
+
+#define MAX_COUNT 1000000
+#define REPEAT    5
+
+static struct {
+	vec4 planes[6];
+	vec3 *center;
+	float *x, *y, *z, *radius;
+	uint32_t *visible, *expect;
+} bench;
+
+static float
+randf(void)
+{
+	return rand() / (float) RAND_MAX * 2 - 1;
+}
+
+static void
+bench_init(void)
+{
+	struct camera cam = { 0 };
+	struct memory_zone zone;
+	size_t i, size = SZ_64M;
+
+	zone.base = xvmalloc(NULL, SZ_4M, size);
+	zone.size = size;
+	zone.used = 0;
+
+	bench.center = mempush(&zone, MAX_COUNT * sizeof(*bench.center));
+	bench.x = mempush(&zone, MAX_COUNT * sizeof(*bench.x));
+	bench.y = mempush(&zone, MAX_COUNT * sizeof(*bench.y));
+	bench.z = mempush(&zone, MAX_COUNT * sizeof(*bench.z));
+	bench.radius = mempush(&zone, MAX_COUNT * sizeof(*bench.radius));
+	bench.visible = mempush(&zone, (MAX_COUNT + 31) / 32 * sizeof(uint32_t));
+	bench.expect = mempush(&zone, (MAX_COUNT + 31) / 32 * sizeof(uint32_t));
+
+	/* around the camera, which looks down -z */
+	srand(1);
+	for (i = 0; i < MAX_COUNT; i++) {
+		bench.center[i] = (vec3){ 100 * randf(), 100 * randf(), 100 * randf() };
+		bench.x[i] = bench.center[i].x;
+		bench.y[i] = bench.center[i].y;
+		bench.z[i] = bench.center[i].z;
+		bench.radius[i] = 1.5f + randf();
+	}
+
+	camera_set_projection(&cam, 1.0, 1.5);
+	mat4_projection_frustum(&cam.proj, bench.planes);
+}
+
+static double
+run_one(size_t count)
+{
+	size_t i;
+	double start = job_time();
+
+	memset(bench.expect, 0, (count + 31) / 32 * sizeof(uint32_t));
+	for (i = 0; i < count; i++)
+		if (!sphere_outside_frustum(bench.planes, bench.center[i], bench.radius[i]))
+			bench.expect[i / 32] |= 1u << (i % 32);
+
+	return job_time() - start;
+}
+
+static double
+run_batch(size_t count)
+{
+	double start = job_time();
+
+	spheres_in_frustum(bench.planes, bench.x, bench.y, bench.z, bench.radius, count, bench.visible);
+
+	return job_time() - start;
+}
+
+int
+main(void)
+{
+	static const size_t counts[] = { 10000, 100000, MAX_COUNT };
+	double one, batch;
+	size_t i, n, count, visible;
+	int repeat, err = 0;
+
+	bench_init();
+	printf("cull: ns per entity\n");
+	for (n = 0; n < ARRAY_LEN(counts); n++) {
+		count = counts[n];
+		one = batch = 1e9;
+		for (repeat = 0; repeat < REPEAT; repeat++) {
+			one = MIN(one, run_one(count));
+			batch = MIN(batch, run_batch(count));
+		}
+
+		if (memcmp(bench.visible, bench.expect, (count + 31) / 32 * sizeof(uint32_t))) {
+			printf("cull: %zu entities, spheres_in_frustum disagrees with sphere_outside_frustum\n", count);
+			err = 1;
+		}
+		for (i = visible = 0; i < (count + 31) / 32; i++)
+			visible += __builtin_popcount(bench.expect[i]);
+
+		printf("cull: %7zu entities, %zu visible, %5.1f one at a time, %5.1f four at a time\n",
+		       count, visible, one / count * 1e9, batch / count * 1e9);
+	}
+
+	return err;
+}
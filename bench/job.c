@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "engine/engine.h"
+#include "plat/core.h"
+
+/* Scaling of the job pool over 1 to N threads, on the work of the frame
+ * build: transform a batch of points and cull them against the frustum.
+ * The flat run pushes every chunk from the calling thread, the nested
+ * run splits the points in halves, each job waiting for its children.
+ * Both must count the same visible points, whatever the thread count. */
+
+#define POINT_COUNT (1 << 20)
+#define CHUNK_COUNT 4096 /* points per job */
+#define REPEAT      10
+
+struct range {
+	size_t first, count;
+};
+
+static struct {
+	mat4 transform;
+	vec4 planes[6];
+	vec3 *pos, *out;
+	float *x, *y, *z, *radius;
+	uint32_t *visible_mask;
+	atomic_uint visible;
+} bench;
+
+static void
+cull_chunk(struct job_worker *worker, void *arg)
+{
+	struct range *range = arg;
+	size_t i, first = range->first, visible = 0;
+	UNUSED(worker);
+
+	mat4_mult_vec3_batch(&bench.transform, bench.pos + first, bench.out + first, range->count);
+	for (i = first; i < first + range->count; i++) {
+		bench.x[i] = bench.out[i].x;
+		bench.y[i] = bench.out[i].y;
+		bench.z[i] = bench.out[i].z;
+	}
+	spheres_in_frustum(bench.planes, bench.x + first, bench.y + first, bench.z + first,
+			   bench.radius + first, range->count, bench.visible_mask + first / 32);
+	for (i = 0; i < range->count / 32; i++)
+		visible += __builtin_popcount(bench.visible_mask[first / 32 + i]);
+	atomic_fetch_add(&bench.visible, visible);
+}
+
+static void
+cull_split(struct job_worker *worker, void *arg)
+{
+	struct range *range = arg, *half;
+	struct job_counter counter;
+
+	if (range->count <= CHUNK_COUNT) {
+		cull_chunk(worker, arg);
+		return;
+	}
+
+	/* the scratch is given back once the children are done */
+	half = mempush(&worker->scratch, 2 * sizeof(*half));
+	half[0].first = range->first;
+	half[0].count = range->count / 2;
+	half[1].first = range->first + half[0].count;
+	half[1].count = range->count - half[0].count;
+
+	job_counter_init(&counter);
+	job_push_counter(worker->pool, cull_split, &half[0], &counter);
+	job_push_counter(worker->pool, cull_split, &half[1], &counter);
+	job_wait_counter(worker->pool, &counter);
+}
+
+static double
+run_flat(struct job_pool *pool, unsigned int *visible)
+{
+	static struct range chunks[POINT_COUNT / CHUNK_COUNT];
+	double start = job_time();
+	size_t i;
+
+	atomic_store(&bench.visible, 0);
+	for (i = 0; i < ARRAY_LEN(chunks); i++) {
+		chunks[i].first = i * CHUNK_COUNT;
+		chunks[i].count = CHUNK_COUNT;
+		job_push(pool, cull_chunk, &chunks[i]);
+	}
+	job_wait(pool);
+	*visible = atomic_load(&bench.visible);
+
+	return job_time() - start;
+}
+
+static double
+run_nested(struct job_pool *pool, unsigned int *visible)
+{
+	static struct range all = { 0, POINT_COUNT };
+	double start = job_time();
+
+	atomic_store(&bench.visible, 0);
+	job_push(pool, cull_split, &all);
+	job_wait(pool);
+	*visible = atomic_load(&bench.visible);
+
+	return job_time() - start;
+}
+
+static void
+bench_init(void)
+{
+	struct camera cam = { 0 };
+	struct memory_zone zone;
+	size_t i;
+
+	zone.base = xvmalloc(NULL, SZ_4M, SZ_64M);
+	zone.size = SZ_64M;
+	zone.used = 0;
+
+	bench.pos = mempush(&zone, POINT_COUNT * sizeof(*bench.pos));
+	bench.out = mempush(&zone, POINT_COUNT * sizeof(*bench.out));
+	bench.x = mempush(&zone, POINT_COUNT * sizeof(*bench.x));
+	bench.y = mempush(&zone, POINT_COUNT * sizeof(*bench.y));
+	bench.z = mempush(&zone, POINT_COUNT * sizeof(*bench.z));
+	bench.radius = mempush(&zone, POINT_COUNT * sizeof(*bench.radius));
+	bench.visible_mask = mempush(&zone, POINT_COUNT / 8);
+
+	srand(1);
+	for (i = 0; i < POINT_COUNT; i++) {
+		bench.pos[i].x = rand() % 200 - 100.0f;
+		bench.pos[i].y = rand() % 200 - 100.0f;
+		bench.pos[i].z = rand() % 200 - 100.0f;
+		bench.radius[i] = 1.0f;
+	}
+
+	bench.transform = mat4_transform((vec3){ 1, 2, 3 }, QUATERNION_IDENTITY);
+	camera_set_projection(&cam, 1.0, 1.5);
+	mat4_projection_frustum(&cam.proj, bench.planes);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t size = (JOB_MAX_THREADS + 1) * JOB_MIN_SCRATCH;
+	unsigned int visible, flat_visible, expected = 0;
+	double flat, nested, flat_best, nested_best;
+	static struct job_pool pool;
+	struct memory_zone zone;
+	int threads, max_threads, i, err = 0;
+
+	/* a few threads even on a single cpu, they still steal */
+	max_threads = MIN(MAX(4, job_cpu_count()), JOB_MAX_THREADS);
+	if (argc > 1)
+		max_threads = MIN(atoi(argv[1]), JOB_MAX_THREADS);
+
+	bench_init();
+	zone.base = xvmalloc(NULL, SZ_4M, size);
+	zone.size = size;
+
+	printf("job: %d points, %d per job, %d cpus\n", POINT_COUNT, CHUNK_COUNT, job_cpu_count());
+	for (threads = 1; threads <= max_threads; threads++) {
+		zone.used = 0;
+		job_pool_init(&pool, &zone, threads);
+
+		flat_best = nested_best = 1e9;
+		for (i = 0; i < REPEAT; i++) {
+			flat = run_flat(&pool, &flat_visible);
+			nested = run_nested(&pool, &visible);
+			flat_best = MIN(flat_best, flat);
+			nested_best = MIN(nested_best, nested);
+
+			if (!expected)
+				expected = flat_visible;
+			if (flat_visible != expected || visible != expected) {
+				printf("job: %d threads, visible %u flat and %u nested, expected %u\n",
+				       pool.thread_count, flat_visible, visible, expected);
+				err = 1;
+			}
+		}
+		printf("job: %2d threads, flat %.2f ms, nested %.2f ms, %u visible\n",
+		       pool.thread_count, flat_best * 1000.0, nested_best * 1000.0, expected);
+
+		job_pool_fini(&pool);
+	}
+
+	return err;
+}
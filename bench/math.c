@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine/engine.h"
+#include "plat/core.h"
+
+/* Cost of the mat4 kernels, built twice: bench/math with the engine
+ * math as configured, SIMD with CONFIG_SIMD, and bench/math_scalar with
+ * engine/math.c built without it. The products are checked against a
+ * plain loop, and a checksum of every result is printed to compare the
+ * two builds, they must agree to the bit. */
+
+#define COUNT  4096
+#define REPEAT 100
+
+static struct {
+	mat4 *a, *b, *r;
+	vec3 *pos, *axis, *scale, *v, *out;
+	float *angle;
+	uint32_t sum;
+} bench;
+
+static float
+randf(void)
+{
+	return rand() / (float) RAND_MAX * 2 - 1;
+}
+
+/* the product as the scalar code sums it */
+static mat4
+mult_reference(const mat4 *a, const mat4 *b)
+{
+	mat4 r;
+	int i, j;
+
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 4; j++)
+			r.m[i][j] = a->m[0][j] * b->m[i][0] + a->m[1][j] * b->m[i][1]
+				  + a->m[2][j] * b->m[i][2] + a->m[3][j] * b->m[i][3];
+
+	return r;
+}
+
+/* fnv-1a of the bytes of the results */
+static void
+checksum(const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		bench.sum = (bench.sum ^ p[i]) * 16777619;
+}
+
+static void
+bench_init(void)
+{
+	struct memory_zone zone;
+	size_t i, size = SZ_4M;
+	int j, k;
+
+	zone.base = xvmalloc(NULL, SZ_4M, size);
+	zone.size = size;
+	zone.used = 0;
+
+	bench.a = mempush(&zone, COUNT * sizeof(mat4));
+	bench.b = mempush(&zone, COUNT * sizeof(mat4));
+	bench.r = mempush(&zone, COUNT * sizeof(mat4));
+	bench.pos = mempush(&zone, COUNT * sizeof(vec3));
+	bench.axis = mempush(&zone, COUNT * sizeof(vec3));
+	bench.scale = mempush(&zone, COUNT * sizeof(vec3));
+	bench.v = mempush(&zone, COUNT * sizeof(vec3));
+	bench.out = mempush(&zone, COUNT * sizeof(vec3));
+	bench.angle = mempush(&zone, COUNT * sizeof(float));
+
+	bench.sum = 2166136261u;
+	srand(1);
+	for (i = 0; i < COUNT; i++) {
+		for (j = 0; j < 4; j++) {
+			for (k = 0; k < 4; k++) {
+				bench.a[i].m[j][k] = randf();
+				bench.b[i].m[j][k] = randf();
+			}
+		}
+		bench.pos[i] = (vec3){ 100 * randf(), 100 * randf(), 100 * randf() };
+		bench.axis[i] = vec3_normalize((vec3){ randf(), randf(), randf() + 2 });
+		bench.scale[i] = (vec3){ 1 + randf(), 1 + randf(), 1 + randf() };
+		bench.v[i] = (vec3){ 10 * randf(), 10 * randf(), 10 * randf() };
+		bench.angle[i] = 3 * randf();
+	}
+}
+
+/* ns per element of the best run */
+static double
+run(int op)
+{
+	double start, best = 1e9;
+	size_t i;
+	int repeat;
+
+	for (repeat = 0; repeat < REPEAT; repeat++) {
+		start = job_time();
+		switch (op) {
+		case 0:
+			for (i = 0; i < COUNT; i++)
+				bench.r[i] = mat4_mult_mat4(&bench.a[i], &bench.b[i]);
+			break;
+		case 1:
+			mat4_mult_mat4_batch(&bench.a[0], bench.b, bench.r, COUNT);
+			break;
+		case 2:
+			mat4_mult_vec3_batch(&bench.a[0], bench.v, bench.out, COUNT);
+			break;
+		case 3:
+			for (i = 0; i < COUNT; i++)
+				bench.r[i] = mat4_transform_scale(bench.pos[i],
+					quaternion_axis_angle(bench.axis[i], bench.angle[i]), bench.scale[i]);
+			break;
+		}
+		best = MIN(best, job_time() - start);
+	}
+
+	return best / COUNT * 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char *const name[] = {
+		"mat4_mult_mat4", "mat4_mult_mat4_batch", "mat4_mult_vec3_batch", "mat4_transform_scale",
+	};
+	const char *build = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+	mat4 expect;
+	vec3 point;
+	size_t i;
+	int op, err = 0;
+	UNUSED(argc);
+
+	bench_init();
+	printf("%s: %d elements, ns per element\n", build, COUNT);
+	for (op = 0; op < (int) ARRAY_LEN(name); op++) {
+		printf("%s: %-22s %6.1f\n", build, name[op], run(op));
+
+		for (i = 0; i < COUNT; i++) {
+			switch (op) {
+			case 0:
+				expect = mult_reference(&bench.a[i], &bench.b[i]);
+				err |= memcmp(&expect, &bench.r[i], sizeof(expect)) != 0;
+				break;
+			case 1:
+				expect = mult_reference(&bench.a[0], &bench.b[i]);
+				err |= memcmp(&expect, &bench.r[i], sizeof(expect)) != 0;
+				break;
+			case 2:
+				point = mat4_mult_vec3(&bench.a[0], bench.v[i]);
+				err |= memcmp(&point, &bench.out[i], sizeof(point)) != 0;
+				break;
+			}
+		}
+		if (op == 2)
+			checksum(bench.out, COUNT * sizeof(vec3));
+		else
+			checksum(bench.r, COUNT * sizeof(mat4));
+		if (err) {
+			printf("%s: %s differs from the scalar product\n", build, name[op]);
+			return 1;
+		}
+	}
+	printf("%s: checksum %08x\n", build, bench.sum);
+
+	return 0;
+}
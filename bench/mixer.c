@@ -0,0 +1,378 @@
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "engine/engine.h"
+#include "plat/core.h"
+
+/* Offline run of the mixer: a fixed script of plays, volumes, pans,
+ * pauses and stops is rendered on a simulated clock, one device period
+ * at a time, as the audio thread would. The output is written to a wav
+ * file and compared with a reference mixed sample by sample with
+ * step_sampler, then the throughput and the cost per voice are
+ * reported. The sounds are synthesized, the run does not depend on the
+ * assets nor on the time it takes.
+ * Then a second of N looping voices is mixed by mixer_render, a block
+ * per voice, and by step_sampler, a frame per voice as game_step used
+ * to, to compare their cost per frame. */
+
+#define RATE      48000
+#define PERIOD    480 /* frames per render, 10 ms */
+#define PERIODS   600 /* rendered, 6 s */
+#define VOICES    16
+#define VOLUME    0.8f
+#define TOLERANCE 1e-5f /* the block mixer does not round as step_sampler */
+#define REPEAT    10 /* of the voice sweep, the best run counts */
+
+enum {
+	SOUND_TONE,
+	SOUND_NOISE,
+	SOUND_SWEEP,
+	SOUND_COUNT
+};
+
+enum {
+	GROUP_SFX = 1,
+	GROUP_MUSIC,
+};
+
+/* target is the sound to play, else the play it applies to, counted from
+ * 1, 0 for every voice of the group */
+struct event {
+	unsigned int period;
+	enum mixer_cmd_type type;
+	unsigned int target;
+	unsigned int group;
+	float value;
+	float pan;
+};
+
+static const struct event script[] = {
+	{   0, MIXER_PLAY,   SOUND_SWEEP, 0, 1.0f,  0.0f },
+	{   0, MIXER_PLAY,   SOUND_NOISE, 0, 0.5f, -0.5f },
+	{  20, MIXER_PLAY,   SOUND_TONE,  0, 1.0f,  0.8f },
+	{  45, MIXER_PLAY,   SOUND_TONE,  0, 0.6f, -0.3f },
+	{  50, MIXER_VOLUME, 2,           0, 0.25f, 0.0f },
+	{  80, MIXER_PAN,    1,           0, -0.7f, 0.0f },
+	{ 100, MIXER_PAUSE,  0,   GROUP_MUSIC, 1.0f, 0.0f },
+	{ 130, MIXER_PLAY,   SOUND_TONE,  0, 0.4f,  0.0f },
+	{ 150, MIXER_PAUSE,  0,   GROUP_MUSIC, 0.0f, 0.0f },
+	{ 210, MIXER_PLAY,   SOUND_SWEEP, 0, 0.7f,  0.5f },
+	{ 260, MIXER_STOP,   2,           0, 0.0f,  0.0f },
+	{ 300, MIXER_PAUSE,  6,           0, 1.0f,  0.0f },
+	{ 320, MIXER_PLAY,   SOUND_NOISE, 0, 1.0f,  0.2f },
+	{ 340, MIXER_PAUSE,  6,           0, 0.0f,  0.0f },
+	{ 400, MIXER_VOLUME, 0,   GROUP_SFX, 0.5f,  0.0f },
+	{ 450, MIXER_STOP,   0,   GROUP_SFX, 0.0f,  0.0f },
+	{ 500, MIXER_PLAY,   SOUND_TONE,  0, 1.0f, -1.0f },
+	{ 550, MIXER_STOP,   7,           0, 0.0f,  0.0f },
+};
+
+/* a voice as the reference sees it, mixed with step_sampler */
+struct ref_voice {
+	struct sampler sampler;
+	unsigned int group;
+	float sound_gain, gain, pan;
+	int paused, stopped;
+};
+
+static struct mixer mixer;
+static struct mixer_sound sounds[SOUND_COUNT];
+static struct ref_voice ref[ARRAY_LEN(script)];
+static unsigned int ids[ARRAY_LEN(script)];
+static unsigned int play_count;
+
+static struct wav
+make_wav(struct memory_zone *zone, size_t frames)
+{
+	struct wav wav = { 0 };
+
+	wav.header.channels = 2;
+	wav.header.samplerate = RATE;
+	wav.extras.samplesize = sizeof(int16_t);
+	wav.extras.nb_frames = frames;
+	wav.extras.nb_samples = 2 * frames;
+	wav.audio_data = mempush(zone, 2 * frames * sizeof(int16_t));
+
+	return wav;
+}
+
+static void
+make_sounds(struct memory_zone *zone, struct wav wav[SOUND_COUNT])
+{
+	unsigned int seed = 1;
+	int16_t *p;
+	double phase = 0;
+	size_t i;
+
+	/* 440 Hz, half a second */
+	wav[SOUND_TONE] = make_wav(zone, RATE / 2);
+	p = wav[SOUND_TONE].audio_data;
+	for (i = 0; i < RATE / 2; i++)
+		p[2 * i] = p[2 * i + 1] = 16000 * sin(2 * M_PI * 440 * i / RATE);
+
+	/* a fifth of a second of noise, looped past its first half */
+	wav[SOUND_NOISE] = make_wav(zone, RATE / 5);
+	p = wav[SOUND_NOISE].audio_data;
+	for (i = 0; i < 2 * RATE / 5; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = (int16_t) (seed >> 16) / 4;
+	}
+
+	/* 200 Hz to 2 kHz over two seconds, out of phase on the right */
+	wav[SOUND_SWEEP] = make_wav(zone, 2 * RATE);
+	p = wav[SOUND_SWEEP].audio_data;
+	for (i = 0; i < 2 * RATE; i++) {
+		phase += 2 * M_PI * (200 + 1800 * i / (2.0 * RATE)) / RATE;
+		p[2 * i] = 12000 * sin(phase);
+		p[2 * i + 1] = -p[2 * i];
+	}
+
+	sounds[SOUND_TONE] = (struct mixer_sound){
+		.wav = &wav[SOUND_TONE], .gain = 0.5, .group = GROUP_SFX,
+	};
+	sounds[SOUND_NOISE] = (struct mixer_sound){
+		.wav = &wav[SOUND_NOISE], .gain = 0.3, .group = GROUP_SFX,
+		.loop_on = 1, .loop_start = RATE / 5,
+	};
+	sounds[SOUND_SWEEP] = (struct mixer_sound){
+		.wav = &wav[SOUND_SWEEP], .gain = 0.8, .group = GROUP_MUSIC,
+		.loop_on = 1,
+	};
+	for (i = 0; i < SOUND_COUNT; i++)
+		mixer_sound(&mixer, i, sounds[i]);
+}
+
+static void
+ref_apply(struct ref_voice *voice, enum mixer_cmd_type type, float value)
+{
+	switch (type) {
+	case MIXER_PLAY:
+		break;
+	case MIXER_STOP:
+		voice->stopped = 1;
+		break;
+	case MIXER_PAUSE:
+		voice->paused = (value != 0);
+		break;
+	case MIXER_VOLUME:
+		voice->gain = voice->sound_gain * value;
+		break;
+	case MIXER_PAN:
+		voice->pan = value;
+		break;
+	}
+}
+
+/* send the commands of a period to the mixer and to the reference */
+static void
+run_script(unsigned int period)
+{
+	const struct event *e;
+	struct ref_voice *voice;
+	unsigned int i;
+
+	for (e = script; e < script + ARRAY_LEN(script); e++) {
+		if (e->period != period)
+			continue;
+
+		if (e->type == MIXER_PLAY) {
+			ids[play_count] = mixer_play(&mixer, e->target, e->value, e->pan);
+			voice = &ref[play_count++];
+			sampler_init(&voice->sampler, sounds[e->target].wav);
+			voice->sampler.loop_on = sounds[e->target].loop_on;
+			voice->sampler.loop_start = sounds[e->target].loop_start;
+			voice->sampler.trig_on = 1;
+			voice->group = sounds[e->target].group;
+			voice->sound_gain = sounds[e->target].gain;
+			voice->gain = voice->sound_gain * e->value;
+			voice->pan = e->pan;
+		} else if (e->target) {
+			mixer_push(&mixer, e->type, ids[e->target - 1], e->value);
+			ref_apply(&ref[e->target - 1], e->type, e->value);
+		} else {
+			mixer_push_group(&mixer, e->type, e->group, e->value);
+			for (i = 0; i < play_count; i++)
+				if (ref[i].group == e->group)
+					ref_apply(&ref[i], e->type, e->value);
+		}
+	}
+}
+
+static void
+ref_render(struct sample *out, size_t frames)
+{
+	struct ref_voice *voice;
+	float l, r;
+	size_t i, n;
+
+	for (n = 0; n < frames; n++) {
+		out[n].l = out[n].r = 0;
+		for (i = 0; i < play_count; i++) {
+			voice = &ref[i];
+			if (voice->stopped || voice->paused)
+				continue;
+			l = voice->gain * MIN(1, 1 - voice->pan);
+			r = voice->gain * MIN(1, 1 + voice->pan);
+			out[n].l += l * step_sampler(&voice->sampler);
+			out[n].r += r * step_sampler(&voice->sampler);
+		}
+		out[n].l *= VOLUME;
+		out[n].r *= VOLUME;
+	}
+}
+
+static void
+put_le(FILE *f, uint32_t v, int n)
+{
+	while (n--) {
+		fputc(v & 0xff, f);
+		v >>= 8;
+	}
+}
+
+/* float stereo wav, as the file audio backend writes */
+static int
+write_wav(const char *path, const struct sample *data, size_t frames)
+{
+	uint32_t datasize = frames * sizeof(*data);
+	FILE *f = fopen(path, "wb");
+
+	if (!f) {
+		printf("mixer: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	fwrite("RIFF", 4, 1, f);
+	put_le(f, 36 + datasize, 4);
+	fwrite("WAVEfmt ", 8, 1, f);
+	put_le(f, 16, 4);
+	put_le(f, 3, 2); /* IEEE float */
+	put_le(f, 2, 2);
+	put_le(f, RATE, 4);
+	put_le(f, RATE * sizeof(*data), 4);
+	put_le(f, sizeof(*data), 2);
+	put_le(f, 32, 2);
+	fwrite("data", 4, 1, f);
+	put_le(f, datasize, 4);
+	fwrite(data, sizeof(*data), frames, f);
+
+	return fclose(f);
+}
+
+/* a second of count voices, mixed by blocks then by frames */
+static int
+sweep_voices(struct memory_zone *zone, struct wav *wav, unsigned int count)
+{
+	size_t used = zone->used;
+	struct mixer sweep;
+	struct sampler *sampler;
+	struct sample *out, *expect;
+	struct audio audio;
+	double start, block = 1e9, step = 1e9;
+	float diff = 0;
+	size_t i, n;
+	int repeat;
+
+	mixer_init(&sweep, zone, count, 1, 1.0f);
+	mixer_sound(&sweep, 0, (struct mixer_sound){ .wav = wav, .gain = 1.0f, .loop_on = 1 });
+	sampler = mempush(zone, count * sizeof(*sampler));
+	out = mempush(zone, RATE * sizeof(*out));
+	expect = mempush(zone, RATE * sizeof(*expect));
+	for (i = 0; i < count; i++) {
+		mixer_play(&sweep, 0, 1.0f, 0.0f);
+		sampler_init(&sampler[i], wav);
+		sampler[i].loop_on = 1;
+		sampler[i].trig_on = 1;
+	}
+
+	/* both play on from where the last run stopped, in step */
+	for (repeat = 0; repeat < REPEAT; repeat++) {
+		start = job_time();
+		for (n = 0; n < RATE; n += PERIOD) {
+			audio.buffer = out + n;
+			audio.size = PERIOD;
+			audio.samplerate = RATE;
+			mixer_render(&sweep, &audio);
+		}
+		block = MIN(block, job_time() - start);
+
+		start = job_time();
+		for (n = 0; n < RATE; n++) {
+			expect[n].l = expect[n].r = 0;
+			for (i = 0; i < count; i++) {
+				expect[n].l += step_sampler(&sampler[i]);
+				expect[n].r += step_sampler(&sampler[i]);
+			}
+		}
+		step = MIN(step, job_time() - start);
+
+		for (n = 0; n < RATE; n++)
+			diff = MAX(diff, MAX(fabsf(out[n].l - expect[n].l), fabsf(out[n].r - expect[n].r)));
+	}
+	zone->used = used;
+
+	printf("mixer: %2u voices, %5.1f ns/frame by blocks, %6.1f ns/frame by step_sampler%s\n",
+	       count, block / RATE * 1e9, step / RATE * 1e9, diff > TOLERANCE ? ", DIFFERENT" : "");
+
+	return diff > TOLERANCE;
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct wav wav[SOUND_COUNT];
+	struct memory_zone zone;
+	struct sample *out, *expect;
+	struct audio audio;
+	char path[256];
+	float diff, max_diff = 0;
+	size_t i, frames = PERIODS * PERIOD;
+	/* 9 as the game plays at most */
+	static const unsigned int sweep[] = { 1, 2, 4, 8, 9, VOICES };
+	unsigned int period;
+	int err;
+
+	zone.base = xvmalloc(NULL, SZ_4M, SZ_16M);
+	zone.size = SZ_16M;
+	zone.used = 0;
+
+	mixer_init(&mixer, &zone, VOICES, SOUND_COUNT, VOLUME);
+	make_sounds(&zone, wav);
+	out = mempush(&zone, frames * sizeof(*out));
+	expect = mempush(&zone, frames * sizeof(*expect));
+
+	/* the simulated device asks for a period at a time */
+	for (period = 0; period < PERIODS; period++) {
+		run_script(period);
+		audio.buffer = out + period * PERIOD;
+		audio.size = PERIOD;
+		audio.samplerate = RATE;
+		mixer_render(&mixer, &audio);
+		ref_render(expect + period * PERIOD, PERIOD);
+	}
+
+	for (i = 0; i < frames; i++) {
+		diff = MAX(fabsf(out[i].l - expect[i].l), fabsf(out[i].r - expect[i].r));
+		max_diff = MAX(max_diff, diff);
+	}
+
+	snprintf(path, sizeof(path), "%s.wav", argc > 1 ? argv[1] : argv[0]);
+	if (write_wav(path, out, frames) < 0)
+		return 1;
+
+	printf("mixer: %zu frames, %u plays, written to %s\n", frames, play_count, path);
+	printf("mixer: %.3f ms, %.1f Mframes/s, %.0fx realtime, %.1f ns/frame per voice\n",
+	       mixer.time * 1000.0, mixer.frames / mixer.time / 1e6,
+	       mixer.frames / (double) RATE / mixer.time,
+	       mixer.time / mixer.voice_frames * 1e9);
+	printf("mixer: %s the step_sampler reference, max error %g\n",
+	       max_diff <= TOLERANCE ? "matches" : "DIFFERS from", max_diff);
+
+	err = max_diff > TOLERANCE;
+	for (i = 0; i < ARRAY_LEN(sweep); i++)
+		err |= sweep_voices(&zone, &wav[SOUND_NOISE], sweep[i]);
+
+	return err;
+}
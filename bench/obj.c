@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "plat/core.h"
+/* for load_obj, as the game loads its meshes */
+#include "game/asset.c"
+
+/* Throughput of the obj parser, on the shipped meshes and on a grid
+ * large enough to leave the caches, about 7 MB of text. The grid
+ * coordinates are multiples of 1/4 so they parse exactly: the vertex
+ * and index counts and the sum of the positions are checked. */
+
+#define GRID   256 /* vertices per side */
+#define REPEAT 10
+
+static const char *const meshes[] = {
+	"res/cap.obj",
+	"res/menu_quit.obj",
+	"res/menu_start.obj",
+	"res/player.obj",
+	"res/rock.obj",
+	"res/room.obj",
+	"res/screen.obj",
+	"res/wall.obj",
+};
+
+/* a square of GRID * GRID vertices, in quads */
+static struct asset_file
+make_grid(struct memory_zone *zone)
+{
+	struct asset_file file = { 0 };
+	size_t size = (size_t) GRID * GRID * 128, len = 0;
+	int x, y, a, b;
+
+	file.name = "grid";
+	file.data = mempush(zone, size);
+	for (y = 0; y < GRID; y++) {
+		for (x = 0; x < GRID; x++) {
+			len += snprintf(file.data + len, size - len, "v %.2f %.2f %.2f\n",
+					x * 0.25, (x + y) % 16 * 0.25, y * 0.25);
+			len += snprintf(file.data + len, size - len, "vt %.4f %.4f\n",
+					x / (double) GRID, y / (double) GRID);
+			len += snprintf(file.data + len, size - len, "vn 0 1 0\n");
+		}
+	}
+	for (y = 0; y < GRID - 1; y++) {
+		for (x = 0; x < GRID - 1; x++) {
+			a = y * GRID + x + 1;
+			b = a + GRID;
+			len += snprintf(file.data + len, size - len, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
+					a, a, a, b, b, b, b + 1, b + 1, b + 1, a + 1, a + 1, a + 1);
+		}
+	}
+	file.size = len;
+
+	return file;
+}
+
+/* best parse time of the file */
+static double
+parse(struct memory_zone *zone, struct asset_file *file, struct obj_data *obj)
+{
+	struct memory_zone mem_state = *zone;
+	double start, best = 1e9;
+	int repeat;
+
+	for (repeat = 0; repeat < REPEAT; repeat++) {
+		*zone = mem_state;
+		start = job_time();
+		load_obj(zone, file, obj);
+		best = MIN(best, job_time() - start);
+	}
+
+	return best;
+}
+
+static void
+report(const char *name, size_t size, const struct obj_data *obj, double time)
+{
+	printf("obj: %-18s %8zu bytes, %6zu vertices, %6zu triangles, %7.3f ms, %6.1f MB/s\n",
+	       name, size, obj->vertex_count, obj->index_count / 3, time * 1e3, size / time / 1e6);
+}
+
+int
+main(void)
+{
+	struct memory_zone zone, mem_state;
+	struct asset_file file = { 0 };
+	struct obj_data obj;
+	double time, sum, expect = 0;
+	size_t i;
+	int x, y;
+
+	zone.base = xvmalloc(NULL, SZ_4M, SZ_64M);
+	zone.size = SZ_64M;
+	zone.used = 0;
+
+	for (i = 0; i < ARRAY_LEN(meshes); i++) {
+		mem_state = zone;
+		file.name = meshes[i];
+		file.size = file_size(meshes[i]);
+		if (file.size <= 0) {
+			printf("obj: %s: cannot be read\n", meshes[i]);
+			return 1;
+		}
+		file.data = mempush(&zone, file.size + 1);
+		file_read(meshes[i], file.data, file.size);
+		file.data[file.size] = '\0';
+
+		time = parse(&zone, &file, &obj);
+		report(meshes[i], file.size, &obj, time);
+		zone = mem_state;
+	}
+
+	file = make_grid(&zone);
+	time = parse(&zone, &file, &obj);
+	report(file.name, file.size, &obj, time);
+
+	for (y = 0; y < GRID; y++)
+		for (x = 0; x < GRID; x++)
+			expect += x * 0.25 + (x + y) % 16 * 0.25 + y * 0.25;
+	for (i = 0, sum = 0; i < 3 * obj.vertex_count; i++)
+		sum += obj.positions[i];
+	if (obj.vertex_count != GRID * GRID || obj.index_count != 6 * (GRID - 1) * (GRID - 1)
+	    || sum != expect) {
+		printf("obj: grid parsed as %zu vertices and %zu indices, position sum %g, expected %d, %d and %g\n",
+		       obj.vertex_count, obj.index_count, sum, GRID * GRID, 6 * (GRID - 1) * (GRID - 1), expect);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "engine/engine.h"
+#include "plat/core.h"
+
+/* Cost of the resampler per voice: a second of a 1 kHz sine is
+ * converted from the wav rate to the device rate, timed per output
+ * frame next to sampler_render at the device rate. The output is
+ * fitted to a sine at the same frequency, what the fit leaves out is
+ * the noise and distortion of the conversion, reported as a SNR. */
+
+#define FREQ    1000
+#define SECONDS 2 /* of source, only the first one is rendered */
+#define SKIP    64 /* output frames, while the history fills up */
+#define REPEAT  10
+#define MIN_SNR 70.0 /* dB */
+
+struct conversion {
+	unsigned int src, dst;
+};
+
+static const struct conversion conversions[] = {
+	{ 44100, 48000 },
+	{ 22050, 48000 },
+	{ 48000, 44100 },
+	{ 48000, 48000 }, /* sampler_render alone, for reference */
+};
+
+static struct wav
+make_sine(struct memory_zone *zone, unsigned int rate)
+{
+	struct wav wav = { 0 };
+	size_t i, frames = SECONDS * rate;
+	int16_t *p;
+
+	wav.header.channels = 2;
+	wav.header.samplerate = rate;
+	wav.extras.samplesize = sizeof(int16_t);
+	wav.extras.nb_frames = frames;
+	wav.extras.nb_samples = 2 * frames;
+	wav.audio_data = p = mempush(zone, 2 * frames * sizeof(int16_t));
+	for (i = 0; i < frames; i++)
+		p[2 * i] = p[2 * i + 1] = 16000 * sin(2 * M_PI * FREQ * i / rate);
+
+	return wav;
+}
+
+/* least squares fit of a sine at FREQ, the residue is the noise */
+static double
+sine_snr(const float *out, size_t frames, unsigned int rate)
+{
+	double ss = 0, sc = 0, cc = 0, xs = 0, xc = 0, xx = 0;
+	double s, c, x, a, b, det, signal, noise = 0;
+	size_t i;
+
+	for (i = SKIP; i < frames; i++) {
+		s = sin(2 * M_PI * FREQ * i / rate);
+		c = cos(2 * M_PI * FREQ * i / rate);
+		x = out[2 * i];
+		ss += s * s;
+		sc += s * c;
+		cc += c * c;
+		xs += x * s;
+		xc += x * c;
+		xx += x * x;
+	}
+	det = ss * cc - sc * sc;
+	a = (xs * cc - xc * sc) / det;
+	b = (xc * ss - xs * sc) / det;
+
+	for (i = SKIP; i < frames; i++) {
+		s = sin(2 * M_PI * FREQ * i / rate);
+		c = cos(2 * M_PI * FREQ * i / rate);
+		x = out[2 * i] - a * s - b * c;
+		noise += x * x;
+	}
+	signal = xx - noise;
+
+	return 10 * log10(signal / noise);
+}
+
+static int
+bench_conversion(struct memory_zone *zone, const struct conversion *conv)
+{
+	size_t used = zone->used;
+	static struct resampler rs;
+	struct sampler sampler;
+	struct wav wav = make_sine(zone, conv->src);
+	float *out = mempush(zone, 2 * conv->dst * sizeof(float));
+	double start, best = 1e9, snr;
+	size_t i;
+	int repeat;
+
+	for (repeat = 0; repeat < REPEAT; repeat++) {
+		for (i = 0; i < 2 * conv->dst; i++)
+			out[i] = 0;
+		sampler_init(&sampler, &wav);
+		sampler.trig_on = 1;
+		/* the filter is built on the first call, not timed */
+		rs.src_rate = 0;
+		resampler_render(&rs, &sampler, out, 0, conv->dst);
+
+		start = job_time();
+		if (conv->src != conv->dst)
+			resampler_render(&rs, &sampler, out, conv->dst, conv->dst);
+		else
+			sampler_render(&sampler, out, conv->dst);
+		best = MIN(best, job_time() - start);
+	}
+	snr = sine_snr(out, conv->dst, conv->dst);
+	zone->used = used;
+
+	printf("resampler: %5u to %5u, %5.1f ns/frame per voice, %.1f dB SNR%s\n",
+	       conv->src, conv->dst, best / conv->dst * 1e9, snr, snr < MIN_SNR ? ", TOO LOW" : "");
+
+	return snr < MIN_SNR;
+}
+
+int
+main(void)
+{
+	struct memory_zone zone;
+	size_t i;
+	int err = 0;
+
+	zone.base = xvmalloc(NULL, SZ_4M, SZ_4M);
+	zone.size = SZ_4M;
+	zone.used = 0;
+
+	printf("resampler: %d taps, %d phases, %d Hz sine\n", RESAMPLER_TAPS, RESAMPLER_PHASES, FREQ);
+	for (i = 0; i < ARRAY_LEN(conversions); i++)
+		err |= bench_conversion(&zone, &conversions[i]);
+
+	return err;
+}
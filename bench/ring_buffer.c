@@ -0,0 +1,188 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "engine/engine.h"
+#include "plat/core.h"
+
+/* Two threads move a counter through the ring in batches of random
+ * sizes, the consumer checks every element: a missed or torn publication
+ * shows up as an error. Then the throughput of audio sized blocks of
+ * stereo frames. */
+
+#define STRESS_COUNT 20000000
+#define STRESS_NMEMB 4096
+#define BENCH_COUNT  50000000
+#define BENCH_NMEMB  4096
+#define BENCH_BLOCK  256
+
+struct frame {
+	float left, right;
+};
+
+struct side {
+	struct ring_buffer *rbuf;
+	size_t count;
+	size_t max_batch;
+	size_t errors;
+	size_t wraps;
+};
+
+static size_t
+batch(unsigned int *seed, size_t avail, size_t max)
+{
+	*seed = *seed * 1103515245 + 12345;
+
+	return MIN(avail, 1 + (*seed >> 16) % max);
+}
+
+static void *
+stress_producer(void *arg)
+{
+	struct side *side = arg;
+	unsigned int seed = 1;
+	uint64_t *p, v = 0;
+	size_t i, n;
+
+	while (v < side->count) {
+		n = ring_buffer_write_size(side->rbuf);
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+		n = batch(&seed, MIN(n, side->count - v), side->max_batch);
+		p = ring_buffer_write_addr(side->rbuf);
+		for (i = 0; i < n; i++)
+			p[i] = v++;
+		ring_buffer_write_done(side->rbuf, n);
+	}
+
+	return NULL;
+}
+
+static void
+stress_consumer(struct side *side)
+{
+	struct ring_buffer *rbuf = side->rbuf;
+	unsigned int seed = 7;
+	uint64_t *p, v = 0;
+	size_t i, n;
+
+	while (v < side->count) {
+		n = ring_buffer_read_size(rbuf);
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+		n = batch(&seed, n, side->max_batch);
+		p = ring_buffer_read_addr(rbuf);
+		if ((size_t) (p - (uint64_t *) rbuf->base) + n > rbuf->nmem)
+			side->wraps++;
+		for (i = 0; i < n; i++, v++)
+			if (p[i] != v)
+				side->errors++;
+		ring_buffer_read_done(rbuf, n);
+	}
+}
+
+static int
+stress(const char *name, struct ring_buffer *rbuf, size_t max_batch)
+{
+	struct side side = { rbuf, STRESS_COUNT, max_batch, 0, 0 };
+	pthread_t thread;
+
+	/* off the start, a full ring then ends within a batch */
+	atomic_store(&rbuf->head, STRESS_NMEMB / 3);
+	atomic_store(&rbuf->tail, STRESS_NMEMB / 3);
+
+	if (pthread_create(&thread, NULL, stress_producer, &side))
+		die("pthread_create failed\n");
+	stress_consumer(&side);
+	pthread_join(thread, NULL);
+
+	printf("stress %s: %zu elements, %zu errors, %zu reads across the end\n",
+	       name, side.count, side.errors, side.wraps);
+
+	return side.errors != 0;
+}
+
+static void *
+bench_producer(void *arg)
+{
+	struct side *side = arg;
+	struct frame *p;
+	size_t i, n, done = 0;
+
+	while (done < side->count) {
+		n = MIN(ring_buffer_write_size(side->rbuf), BENCH_BLOCK);
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+		p = ring_buffer_write_addr(side->rbuf);
+		for (i = 0; i < n; i++)
+			p[i] = (struct frame){ done + i, -(float) (done + i) };
+		ring_buffer_write_done(side->rbuf, n);
+		done += n;
+	}
+
+	return NULL;
+}
+
+static void
+bench(struct ring_buffer *rbuf)
+{
+	struct side side = { rbuf, BENCH_COUNT, BENCH_BLOCK, 0, 0 };
+	struct frame *p;
+	pthread_t thread;
+	size_t i, n, done = 0;
+	double start, sum = 0;
+
+	start = job_time();
+	if (pthread_create(&thread, NULL, bench_producer, &side))
+		die("pthread_create failed\n");
+	while (done < side.count) {
+		n = MIN(ring_buffer_read_size(rbuf), BENCH_BLOCK);
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+		p = ring_buffer_read_addr(rbuf);
+		for (i = 0; i < n; i++)
+			sum += p[i].left;
+		ring_buffer_read_done(rbuf, n);
+		done += n;
+	}
+	pthread_join(thread, NULL);
+
+	printf("bench: %zu stereo frames in blocks of %d, %.1f Mframes/s, checksum %g\n",
+	       side.count, BENCH_BLOCK, side.count / (job_time() - start) / 1e6, sum);
+}
+
+int
+main(void)
+{
+	static uint64_t data[STRESS_NMEMB];
+	static struct frame frames[BENCH_NMEMB];
+	struct ring_buffer rbuf;
+	uint64_t *mirror;
+	int err = 0;
+
+	ring_buffer_init(&rbuf, data, STRESS_NMEMB, sizeof(*data));
+	err |= stress("plain", &rbuf, 512);
+
+	mirror = xvmirror(STRESS_NMEMB * sizeof(*mirror));
+	if (mirror) {
+		ring_buffer_init_mirrored(&rbuf, mirror, STRESS_NMEMB, sizeof(*mirror));
+		err |= stress("mirrored", &rbuf, 3000);
+		xvunmirror(mirror, STRESS_NMEMB * sizeof(*mirror));
+	} else {
+		printf("stress mirrored: skipped, no mirrored mapping\n");
+	}
+
+	ring_buffer_init(&rbuf, frames, BENCH_NMEMB, sizeof(*frames));
+	bench(&rbuf);
+
+	return err;
+}
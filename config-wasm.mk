@@ -1,5 +1,8 @@
 CROSS_COMPILE ?= em
 CFLAGS += -s USE_SDL=2
+ifeq ($(CONFIG_SIMD),y)
+CFLAGS += -msimd128
+endif
 LDFLAGS += -s USE_SDL=2 -s USE_WEBGL2=1 -s FULL_ES3=1
 LDFLAGS += -s ASSERTIONS=1 -s TOTAL_MEMORY=$$(( 8 * 64 * 1024 * 1024 ))
 LDFLAGS += $(foreach r,$(RES),--preload-file $(r))
@@ -6,6 +6,10 @@ CONFIG_JACK=n
 CONFIG_PULSE=n
 CONFIG_MINIAUDIO=n
 CONFIG_SDL_AUDIO=y
+# decode music while playing instead of at load time
+CONFIG_OGG_STREAM=y
+# vectorized math kernels (SSE on x86, simd128 on wasm)
+CONFIG_SIMD=y
 
 # Install paths
 PREFIX := /usr/local
@@ -36,13 +40,15 @@ PKG ?= PKG_CONFIG_PATH=$(PKG_CONFIG_PATH) pkg-config
 # Depencies includes and libs
 INCS ?= $(shell $(PKG) --cflags sdl2)
 LIBS ?= $(shell $(PKG) --libs sdl2)
-LIBS += -lm
+LIBS += -lm -lpthread
 
 # Config specific flags
 CFLAGS-$(CONFIG_JACK) += -DCONFIG_JACK
 CFLAGS-$(CONFIG_PULSE) += -DCONFIG_PULSE
 CFLAGS-$(CONFIG_MINIAUDIO) += -DCONFIG_MINIAUDIO
 CFLAGS-$(CONFIG_SDL_AUDIO) += -DCONFIG_SDL_AUDIO
+CFLAGS-$(CONFIG_OGG_STREAM) += -DCONFIG_OGG_STREAM
+CFLAGS-$(CONFIG_SIMD) += -DCONFIG_SIMD
 LIBS-$(CONFIG_JACK) += -lpthread -ljack
 LIBS-$(CONFIG_PULSE) += -lpthread -lpulse
 LIBS-$(CONFIG_MINIAUDIO) += -lpthread
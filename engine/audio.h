@@ -12,6 +12,10 @@ struct sample {
 struct audio {
 	size_t size; /* in sample */
 	struct sample *buffer;
+	unsigned int samplerate; /* of the device */
 };
 
+#include "resampler.h"
+#include "mixer.h"
+
 #endif
@@ -0,0 +1,319 @@
+#include <string.h>
+
+#include "engine.h"
+
+struct bvh_builder {
+	struct bvh *bvh;
+	vec3 *centroid; /* per triangle, then its bounds */
+	vec3 *min;
+	vec3 *max;
+	unsigned int *order; /* triangles in the order of the leaves */
+};
+
+static float
+vec3_axis(vec3 v, int axis)
+{
+	return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+static vec3
+box_min(vec3 u, vec3 v)
+{
+	return (vec3){ MIN(u.x, v.x), MIN(u.y, v.y), MIN(u.z, v.z) };
+}
+
+static vec3
+box_max(vec3 u, vec3 v)
+{
+	return (vec3){ MAX(u.x, v.x), MAX(u.y, v.y), MAX(u.z, v.z) };
+}
+
+/* half of the surface area, only compared with one another */
+static float
+box_area(vec3 min, vec3 max)
+{
+	vec3 d = vec3_sub(max, min);
+
+	if (d.x < 0)
+		return 0; /* empty */
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static int
+bvh_bin(float c, float cmin, float scale)
+{
+	int b = (c - cmin) * scale;
+
+	return MIN(MAX(b, 0), BVH_BINS - 1);
+}
+
+/* find the cheapest split of the triangles, return 0 if keeping them in a
+ * leaf is cheaper, else set the axis and the first bin of the right side */
+static int
+bvh_split(struct bvh_builder *b, struct bvh_node *node, unsigned int first, unsigned int count,
+	  int *split_axis, int *split_bin, vec3 cmin, vec3 cmax)
+{
+	struct { vec3 min, max; unsigned int count; } bin[BVH_BINS];
+	float left_area[BVH_BINS];
+	unsigned int left_count[BVH_BINS];
+	float cost, best = INFINITY, extent, scale;
+	vec3 min, max;
+	unsigned int i, n;
+	int axis, k;
+
+	for (axis = 0; axis < 3; axis++) {
+		extent = vec3_axis(cmax, axis) - vec3_axis(cmin, axis);
+		if (extent <= 0)
+			continue;
+		scale = BVH_BINS / extent;
+
+		for (k = 0; k < BVH_BINS; k++) {
+			bin[k].min = (vec3){ INFINITY, INFINITY, INFINITY };
+			bin[k].max = (vec3){ -INFINITY, -INFINITY, -INFINITY };
+			bin[k].count = 0;
+		}
+		for (i = first; i < first + count; i++) {
+			n = b->order[i];
+			k = bvh_bin(vec3_axis(b->centroid[n], axis), vec3_axis(cmin, axis), scale);
+			bin[k].min = box_min(bin[k].min, b->min[n]);
+			bin[k].max = box_max(bin[k].max, b->max[n]);
+			bin[k].count++;
+		}
+
+		/* sweep from the left, then from the right */
+		min = bin[0].min;
+		max = bin[0].max;
+		n = 0;
+		for (k = 0; k < BVH_BINS - 1; k++) {
+			min = box_min(min, bin[k].min);
+			max = box_max(max, bin[k].max);
+			n += bin[k].count;
+			left_area[k] = box_area(min, max);
+			left_count[k] = n;
+		}
+		min = bin[BVH_BINS - 1].min;
+		max = bin[BVH_BINS - 1].max;
+		n = 0;
+		for (k = BVH_BINS - 1; k > 0; k--) {
+			min = box_min(min, bin[k].min);
+			max = box_max(max, bin[k].max);
+			n += bin[k].count;
+			if (n == 0 || n == count)
+				continue;
+			cost = left_area[k - 1] * left_count[k - 1] + box_area(min, max) * n;
+			if (cost < best) {
+				best = cost;
+				*split_axis = axis;
+				*split_bin = k;
+			}
+		}
+	}
+
+	if (best == INFINITY)
+		return 0; /* the centroids are all the same */
+	if (count > BVH_MAX_LEAF)
+		return 1;
+	/* a node costs about one triangle test more than a leaf */
+	return 1 + best / box_area(node->min, node->max) < count;
+}
+
+static void
+bvh_build_node(struct bvh_builder *b, unsigned int index, unsigned int first, unsigned int count,
+	       unsigned int depth)
+{
+	struct bvh_node *node = &b->bvh->nodes[index];
+	vec3 cmin = { INFINITY, INFINITY, INFINITY };
+	vec3 cmax = { -INFINITY, -INFINITY, -INFINITY };
+	unsigned int i, j, n, tmp;
+	int axis = 0, split = 0;
+	float lo, scale;
+
+	node->min = cmin;
+	node->max = cmax;
+	for (i = first; i < first + count; i++) {
+		n = b->order[i];
+		node->min = box_min(node->min, b->min[n]);
+		node->max = box_max(node->max, b->max[n]);
+		cmin = box_min(cmin, b->centroid[n]);
+		cmax = box_max(cmax, b->centroid[n]);
+	}
+
+	/* past the depth limit the traversal stack could overflow */
+	if (count <= 1 || depth + 1 >= BVH_MAX_DEPTH ||
+	    !bvh_split(b, node, first, count, &axis, &split, cmin, cmax)) {
+		node->index = first;
+		node->count = count;
+		return;
+	}
+
+	/* partition in place, on the same bins as bvh_split */
+	lo = vec3_axis(cmin, axis);
+	scale = BVH_BINS / (vec3_axis(cmax, axis) - lo);
+	for (i = first, j = first + count; i < j;) {
+		if (bvh_bin(vec3_axis(b->centroid[b->order[i]], axis), lo, scale) < split) {
+			i++;
+		} else {
+			tmp = b->order[i];
+			b->order[i] = b->order[--j];
+			b->order[j] = tmp;
+		}
+	}
+
+	/* the left child comes next, the right one after the left subtree */
+	node->count = 0;
+	bvh_build_node(b, b->bvh->node_count++, first, i - first, depth + 1);
+	node->index = b->bvh->node_count++;
+	bvh_build_node(b, node->index, i, first + count - i, depth + 1);
+}
+
+static vec3
+bvh_vertex(const void *positions, size_t stride, unsigned int index)
+{
+	const float *p = (const float *) ((const char *) positions + index * stride);
+
+	return (vec3){ p[0], p[1], p[2] };
+}
+
+void
+bvh_build(struct bvh *bvh, struct memory_zone *zone, const void *positions,
+	  size_t stride, const unsigned int *indices, size_t index_count)
+{
+	struct memory_zone mem_state;
+	struct bvh_builder b;
+	unsigned int i, n = index_count / 3;
+	vec3 v0, v1, v2;
+
+	bvh->triangle_count = n;
+	bvh->node_count = 0;
+	/* the nodes last, the unused ones are given back */
+	bvh->triangles = mempush(zone, n * sizeof(*bvh->triangles));
+	bvh->nodes = mempush(zone, MAX(2 * n, 1) * sizeof(*bvh->nodes));
+	if (n == 0)
+		return;
+
+	mem_state = *zone; /* save memory state */
+	b.bvh = bvh;
+	b.centroid = mempush(zone, n * sizeof(vec3));
+	b.min = mempush(zone, n * sizeof(vec3));
+	b.max = mempush(zone, n * sizeof(vec3));
+	b.order = mempush(zone, n * sizeof(unsigned int));
+
+	for (i = 0; i < n; i++) {
+		v0 = bvh_vertex(positions, stride, indices[3 * i + 0]);
+		v1 = bvh_vertex(positions, stride, indices[3 * i + 1]);
+		v2 = bvh_vertex(positions, stride, indices[3 * i + 2]);
+		b.min[i] = box_min(v0, box_min(v1, v2));
+		b.max[i] = box_max(v0, box_max(v1, v2));
+		b.centroid[i] = vec3_mult(1.0 / 3.0, vec3_add(v0, vec3_add(v1, v2)));
+		b.order[i] = i;
+	}
+
+	bvh_build_node(&b, bvh->node_count++, 0, n, 0);
+
+	for (i = 0; i < n; i++) {
+		unsigned int t = b.order[i];
+
+		v0 = bvh_vertex(positions, stride, indices[3 * t + 0]);
+		v1 = bvh_vertex(positions, stride, indices[3 * t + 1]);
+		v2 = bvh_vertex(positions, stride, indices[3 * t + 2]);
+		bvh->triangles[i].v0 = v0;
+		bvh->triangles[i].e1 = vec3_sub(v1, v0);
+		bvh->triangles[i].e2 = vec3_sub(v2, v0);
+	}
+
+	/* restore memory zone */
+	*zone = mem_state;
+	mempull(zone, (2 * n - bvh->node_count) * sizeof(*bvh->nodes));
+}
+
+/* entry distance of the ray in the node box, INFINITY if it misses or
+ * enters past tmax */
+static float
+bvh_slab(const struct bvh_node *node, vec3 org, vec3 inv, float tmax)
+{
+	float tx1 = (node->min.x - org.x) * inv.x, tx2 = (node->max.x - org.x) * inv.x;
+	float ty1 = (node->min.y - org.y) * inv.y, ty2 = (node->max.y - org.y) * inv.y;
+	float tz1 = (node->min.z - org.z) * inv.z, tz2 = (node->max.z - org.z) * inv.z;
+	float tmin = MAX(MAX(MIN(tx1, tx2), MIN(ty1, ty2)), MIN(tz1, tz2));
+	float tend = MIN(MIN(MAX(tx1, tx2), MAX(ty1, ty2)), MAX(tz1, tz2));
+
+	if (tend < MAX(tmin, 0) || tmin >= tmax)
+		return INFINITY;
+	return tmin;
+}
+
+/* Moller-Trumbore, both faces */
+static int
+bvh_triangle_intersect(const struct bvh_triangle *tri, vec3 org, vec3 dir, float *t)
+{
+	vec3 p = vec3_cross(dir, tri->e2);
+	float det = vec3_dot(tri->e1, p);
+	float inv, u, v, d;
+	vec3 s, q;
+
+	if (fabsf(det) < 1e-12f)
+		return 0; /* parallel */
+	inv = 1 / det;
+	s = vec3_sub(org, tri->v0);
+	u = vec3_dot(s, p) * inv;
+	if (u < 0 || u > 1)
+		return 0;
+	q = vec3_cross(s, tri->e1);
+	v = vec3_dot(dir, q) * inv;
+	if (v < 0 || u + v > 1)
+		return 0;
+	d = vec3_dot(tri->e2, q) * inv;
+	if (d < 0 || d >= *t)
+		return 0;
+
+	*t = d;
+	return 1;
+}
+
+int
+bvh_intersect(const struct bvh *bvh, vec3 org, vec3 dir, float *t)
+{
+	const struct bvh_node *stack[BVH_MAX_DEPTH];
+	const struct bvh_node *node, *a, *b, *swap;
+	vec3 inv = { 1 / dir.x, 1 / dir.y, 1 / dir.z };
+	unsigned int i, top = 0;
+	float ta, tb, tmp;
+	int hit = 0;
+
+	if (bvh->node_count == 0)
+		return 0;
+
+	node = &bvh->nodes[0];
+	if (bvh_slab(node, org, inv, *t) == INFINITY)
+		return 0;
+
+	for (;;) {
+		if (node->count) {
+			for (i = node->index; i < node->index + node->count; i++)
+				hit |= bvh_triangle_intersect(&bvh->triangles[i], org, dir, t);
+		} else {
+			/* nearest child first, the other one is pushed */
+			a = node + 1;
+			b = &bvh->nodes[node->index];
+			ta = bvh_slab(a, org, inv, *t);
+			tb = bvh_slab(b, org, inv, *t);
+			if (tb < ta) {
+				swap = a, a = b, b = swap;
+				tmp = ta, ta = tb, tb = tmp;
+			}
+			if (ta != INFINITY) {
+				/* at most one per level, see BVH_MAX_DEPTH */
+				if (tb != INFINITY)
+					stack[top++] = b;
+				node = a;
+				continue;
+			}
+		}
+		/* skip the boxes entered past a closer hit */
+		do {
+			if (top == 0)
+				return hit;
+			node = stack[--top];
+		} while (bvh_slab(node, org, inv, *t) == INFINITY);
+	}
+}
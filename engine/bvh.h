@@ -0,0 +1,45 @@
+#ifndef BVH_H
+#define BVH_H
+
+/* Bounding volume hierarchy over the triangles of a mesh, for ray casts.
+ * Built with the surface area heuristic over binned centroids, then
+ * flattened depth first: the left child of a node follows it, only the
+ * right child index is stored. The triangles are reordered to be
+ * contiguous in the leaves and hold what Moller-Trumbore needs. */
+
+#define BVH_BINS     12
+#define BVH_MAX_LEAF 8  /* more triangles are always split, if they can */
+#define BVH_MAX_DEPTH 64 /* deeper nodes are leaves, the traversal stack size */
+
+struct bvh_node {
+	vec3 min;
+	unsigned int index; /* leaf: first triangle, node: right child */
+	vec3 max;
+	unsigned int count; /* leaf: number of triangles, node: 0 */
+};
+
+struct bvh_triangle {
+	vec3 v0;
+	vec3 e1; /* v1 - v0 */
+	vec3 e2; /* v2 - v0 */
+};
+
+struct bvh {
+	struct bvh_node *nodes;
+	struct bvh_triangle *triangles;
+	unsigned int node_count;
+	unsigned int triangle_count;
+};
+
+/* Build the bvh of the triangles given by indices, 3 per triangle, into
+ * positions: 3 floats every stride bytes. The triangles and nodes are
+ * pushed in zone, the temporary data and the unused nodes are given
+ * back. */
+void bvh_build(struct bvh *bvh, struct memory_zone *zone, const void *positions,
+	       size_t stride, const unsigned int *indices, size_t index_count);
+
+/* Cast a ray, dir does not need to be normalized. Return 1 and set t to
+ * the distance along dir of the nearest hit closer than t, 0 if none. */
+int bvh_intersect(const struct bvh *bvh, vec3 org, vec3 dir, float *t);
+
+#endif
@@ -3,6 +3,40 @@
 
 #include "engine.h"
 
+static const char *uniform_names[UNIFORM_COUNT] = {
+	[UNIFORM_PROJ]       = "proj",
+	[UNIFORM_VIEW]       = "view",
+	[UNIFORM_TIME]       = "time",
+	[UNIFORM_CAMP]       = "camp",
+	[UNIFORM_RESOLUTION] = "v2Resolution",
+};
+
+static const char *attrib_names[ATTRIB_COUNT] = {
+	[ATTRIB_POSITION] = "in_pos",
+	[ATTRIB_NORMAL]   = "in_normal",
+	[ATTRIB_TEXCOORD] = "in_texcoord",
+	[ATTRIB_MODEL]    = "in_model",
+	[ATTRIB_COLOR]    = "in_color",
+};
+
+/* attributes are bound to the fixed mesh locations before linking */
+static const GLuint attrib_locations[ATTRIB_COUNT] = {
+	[ATTRIB_POSITION] = MESH_ATTRIB_POSITION,
+	[ATTRIB_NORMAL]   = MESH_ATTRIB_NORMAL,
+	[ATTRIB_TEXCOORD] = MESH_ATTRIB_TEXCOORD,
+	[ATTRIB_MODEL]    = MESH_ATTRIB_MODEL,
+	[ATTRIB_COLOR]    = MESH_ATTRIB_COLOR,
+};
+
+static void
+shader_locate(struct shader *s)
+{
+	int i;
+
+	for (i = 0; i < UNIFORM_COUNT; i++)
+		s->uniform[i] = glGetUniformLocation(s->prog, uniform_names[i]);
+}
+
 static GLint
 shader_compile(GLsizei count, const GLchar **string, const GLint *length, GLenum type, GLuint *out)
 {
@@ -39,6 +73,7 @@ shader_reload(struct shader *s, const char *vert_src, const char *frag_src, cons
 	GLint frag_len;
 	GLint geom_len;
 	GLint ret;
+	int i;
 
 	if (vert_src) {
 		vert_len = strlen(vert_src);
@@ -74,6 +109,9 @@ shader_reload(struct shader *s, const char *vert_src, const char *frag_src, cons
 	if (geom)
 		glAttachShader(prog, geom);
 
+	for (i = 0; i < ATTRIB_COUNT; i++)
+		glBindAttribLocation(prog, attrib_locations[i], attrib_names[i]);
+
 	glLinkProgram(prog);
 	glGetProgramiv(prog, GL_LINK_STATUS, &ret);
 	if (ret != GL_TRUE) {
@@ -98,6 +136,7 @@ shader_reload(struct shader *s, const char *vert_src, const char *frag_src, cons
 	s->vert = vert;
 	s->frag = frag;
 	s->frag = geom;
+	shader_locate(s);
 	return 0;
 
 err_link:
@@ -9,18 +9,40 @@
 #include "util.h"
 #include "math.h"
 #include "input.h"
+#include "bvh.h"
 #include "mesh.h"
 #include "camera.h"
+#include "job.h"
 
 #include "ring_buffer.h"
 
 #include "audio.h"
 
+enum shader_uniform {
+	UNIFORM_PROJ,
+	UNIFORM_VIEW,
+	UNIFORM_TIME,
+	UNIFORM_CAMP,
+	UNIFORM_RESOLUTION,
+	UNIFORM_COUNT
+};
+
+enum shader_attrib {
+	ATTRIB_POSITION,
+	ATTRIB_NORMAL,
+	ATTRIB_TEXCOORD,
+	ATTRIB_MODEL, /* per instance */
+	ATTRIB_COLOR, /* per instance */
+	ATTRIB_COUNT
+};
+
 struct shader {
 	GLuint prog;
 	GLuint vert;
 	GLuint frag;
 	GLuint geom;
+	/* locations resolved once at link time, -1 when not used */
+	GLint uniform[UNIFORM_COUNT];
 };
 GLint shader_load(struct shader *s, const char *vert, const char *frag, const char *geom);
 GLint shader_reload(struct shader *s, const char *vert, const char *frag, const char *geom);
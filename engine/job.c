@@ -0,0 +1,360 @@
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+/* The deques follow Le, Pop, Cohen and Zappa Nardelli, "Correct and
+ * efficient work-stealing for weak memory models", without the resizing:
+ * a full deque makes job_push run the job inline. */
+
+static int
+deque_push(struct job_deque *deque, struct job job)
+{
+	long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+	long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+	struct job_slot *slot = &deque->slot[b & (JOB_DEQUE_SIZE - 1)];
+
+	if (b - t >= JOB_DEQUE_SIZE)
+		return 0;
+
+	atomic_store_explicit(&slot->func, job.func, memory_order_relaxed);
+	atomic_store_explicit(&slot->arg, job.arg, memory_order_relaxed);
+	atomic_store_explicit(&slot->counter, job.counter, memory_order_relaxed);
+	/* publish the job after it is written */
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+
+	return 1;
+}
+
+static void
+deque_read(struct job_deque *deque, long i, struct job *job)
+{
+	struct job_slot *slot = &deque->slot[i & (JOB_DEQUE_SIZE - 1)];
+
+	job->func = atomic_load_explicit(&slot->func, memory_order_relaxed);
+	job->arg = atomic_load_explicit(&slot->arg, memory_order_relaxed);
+	job->counter = atomic_load_explicit(&slot->counter, memory_order_relaxed);
+}
+
+/* owner side, the last pushed job */
+static int
+deque_pop(struct job_deque *deque, struct job *job)
+{
+	long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+	long t;
+	int ret = 1;
+
+	atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+	if (t > b) {
+		/* empty */
+		atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+		return 0;
+	}
+
+	deque_read(deque, b, job);
+	if (t == b) {
+		/* the last job, race the thieves for it */
+		if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+				memory_order_seq_cst, memory_order_relaxed))
+			ret = 0;
+		atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+	}
+
+	return ret;
+}
+
+/* thief side, the first pushed job */
+static int
+deque_steal(struct job_deque *deque, struct job *job)
+{
+	long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+	long b;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+	if (t >= b)
+		return 0;
+
+	deque_read(deque, t, job);
+
+	return atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+			memory_order_seq_cst, memory_order_relaxed);
+}
+
+/* the worker of the calling thread, the thread that made the pool if it
+ * is not one of the workers */
+static struct job_worker *
+job_self(struct job_pool *pool)
+{
+	pthread_t self = pthread_self();
+	int i;
+
+	for (i = 0; i < pool->thread_count; i++)
+		if (pthread_equal(pool->workers[i].thread, self))
+			return &pool->workers[i];
+
+	return &pool->caller;
+}
+
+static struct job_deque *
+job_deque(struct job_pool *pool, int i)
+{
+	return i < pool->thread_count ? &pool->workers[i].deque : &pool->caller.deque;
+}
+
+/* pop a job from our own deque, else steal one from the others */
+static int
+job_take(struct job_pool *pool, struct job_worker *worker, struct job *job)
+{
+	int n = pool->thread_count + 1;
+	int self = worker->index < 0 ? pool->thread_count : worker->index;
+	int i;
+
+	if (deque_pop(&worker->deque, job))
+		goto taken;
+	for (i = 1; i < n; i++)
+		if (deque_steal(job_deque(pool, (self + i) % n), job))
+			goto taken;
+
+	return 0;
+taken:
+	atomic_fetch_sub(&pool->queued, 1);
+	return 1;
+}
+
+static void
+job_run(struct job_worker *worker, struct job job)
+{
+	struct job_pool *pool = worker->pool;
+	struct memory_zone mem_state = worker->scratch; /* save memory state */
+
+	job.func(worker, job.arg);
+
+	/* restore memory zone */
+	worker->scratch = mem_state;
+
+	if (job.counter)
+		atomic_fetch_sub(&job.counter->count, 1);
+	atomic_fetch_sub(&pool->pending, 1);
+
+	/* seen by a waiter, or it sees the count, see job_help */
+	if (atomic_load(&pool->waiting) > 0) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+static void *
+job_thread(void *arg)
+{
+	struct job_worker *worker = arg;
+	struct job_pool *pool = worker->pool;
+	struct job job;
+	int quit;
+
+	/* job_pool_init holds the lock until the thread ids are set */
+	pthread_mutex_lock(&pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (;;) {
+		if (job_take(pool, worker, &job)) {
+			job_run(worker, job);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		atomic_fetch_add(&pool->sleeping, 1);
+		while (!pool->quit && atomic_load(&pool->queued) <= 0)
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		atomic_fetch_sub(&pool->sleeping, 1);
+		quit = pool->quit && atomic_load(&pool->queued) <= 0;
+		pthread_mutex_unlock(&pool->lock);
+		if (quit)
+			break;
+	}
+
+	return NULL;
+}
+
+static void
+job_worker_init(struct job_worker *worker, struct job_pool *pool, int index,
+		struct memory_zone *zone, size_t size)
+{
+	worker->pool = pool;
+	worker->index = index;
+	worker->scratch.base = mempush(zone, size);
+	worker->scratch.size = size;
+	worker->scratch.used = 0;
+	atomic_init(&worker->deque.top, 0);
+	atomic_init(&worker->deque.bottom, 0);
+}
+
+void
+job_pool_init(struct job_pool *pool, struct memory_zone *zone, int thread_count)
+{
+	size_t size;
+	int i, count;
+
+	atomic_init(&pool->queued, 0);
+	atomic_init(&pool->pending, 0);
+	atomic_init(&pool->sleeping, 0);
+	atomic_init(&pool->waiting, 0);
+	pool->quit = 0;
+	pool->thread_count = 0;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	/* one more scratch zone for the thread that made the pool */
+	size = zone->size - zone->used;
+	count = MAX(1, MIN(thread_count, JOB_MAX_THREADS));
+	if (count > 1 && (size_t)(count + 1) * JOB_MIN_SCRATCH > size) {
+		count = MAX(1, (int)(size / JOB_MIN_SCRATCH) - 1);
+		warn("job: %d threads asked, %zu KiB of scratch zone only fits %d\n",
+		     thread_count, size / 1024, count);
+	}
+	thread_count = count;
+	size /= thread_count + 1;
+
+	job_worker_init(&pool->caller, pool, -1, zone, size);
+	for (i = 0; i < thread_count; i++)
+		job_worker_init(&pool->workers[i], pool, i, zone, size);
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < thread_count; i++) {
+		if (pthread_create(&pool->workers[i].thread, NULL, job_thread, &pool->workers[i]))
+			break;
+		pool->thread_count++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	if (pool->thread_count == 0)
+		warn("job: no worker thread, jobs run inline\n");
+}
+
+void
+job_pool_fini(struct job_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	/* the workers drain every deque before leaving */
+	for (i = 0; i < pool->thread_count; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+void
+job_push_counter(struct job_pool *pool, job_func_t *func, void *arg, struct job_counter *counter)
+{
+	struct job_worker *worker = job_self(pool);
+	struct job job = { func, arg, counter };
+
+	if (counter)
+		atomic_fetch_add(&counter->count, 1);
+	atomic_fetch_add(&pool->pending, 1);
+
+	if (pool->thread_count == 0 || !deque_push(&worker->deque, job)) {
+		job_run(worker, job);
+		return;
+	}
+
+	/* seen by a sleeping worker, or it sees the job, see job_thread */
+	atomic_fetch_add(&pool->queued, 1);
+	if (atomic_load(&pool->sleeping) > 0 || atomic_load(&pool->waiting) > 0) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_signal(&pool->wake);
+		pthread_cond_broadcast(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+void
+job_push(struct job_pool *pool, job_func_t *func, void *arg)
+{
+	job_push_counter(pool, func, arg, NULL);
+}
+
+/* run jobs until count drops to 0, sleep when there are none to take */
+static void
+job_help(struct job_pool *pool, atomic_uint *count)
+{
+	struct job_worker *worker = job_self(pool);
+	struct job job;
+
+	while (atomic_load(count) > 0) {
+		if (job_take(pool, worker, &job)) {
+			job_run(worker, job);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		atomic_fetch_add(&pool->waiting, 1);
+		while (atomic_load(count) > 0 && atomic_load(&pool->queued) <= 0)
+			pthread_cond_wait(&pool->done, &pool->lock);
+		atomic_fetch_sub(&pool->waiting, 1);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+void
+job_wait(struct job_pool *pool)
+{
+	job_help(pool, &pool->pending);
+}
+
+void
+job_counter_init(struct job_counter *counter)
+{
+	atomic_init(&counter->count, 0);
+}
+
+void
+job_wait_counter(struct job_pool *pool, struct job_counter *counter)
+{
+	job_help(pool, &counter->count);
+}
+
+void
+job_lock(struct job_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+}
+
+void
+job_unlock(struct job_pool *pool)
+{
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int
+job_cpu_count(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > 0)
+		return n;
+#endif
+	return 1;
+}
+
+double
+job_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,102 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* A pool of worker threads with work stealing. Each worker owns a
+ * Chase-Lev deque: it pushes and pops jobs at the bottom, the idle
+ * workers steal from the top. The thread that makes the pool has a deque
+ * too, and runs jobs while it waits. Jobs may only be pushed by the
+ * workers and by that thread.
+ * Each worker owns a scratch memory zone, reset after every job.
+ * A job may be given a counter, raised when pushed and lowered once run:
+ * waiting for the counter waits for a group of jobs, eg. to start a job
+ * only once the ones it depends on are done.
+ * If no thread can be created (no threads support) jobs run inline in
+ * job_push, on the calling thread. */
+
+#define JOB_MAX_THREADS 16
+#define JOB_MIN_SCRATCH SZ_8M /* per worker, fewer threads are started otherwise */
+#define JOB_DEQUE_SIZE  256 /* a power of two, a job pushed to a full deque runs inline */
+#define JOB_CACHE_LINE  64
+
+struct job_pool;
+
+struct job_counter {
+	atomic_uint count; /* jobs pushed and not done yet */
+};
+
+struct job_worker;
+typedef void (job_func_t)(struct job_worker *worker, void *arg);
+
+struct job {
+	job_func_t *func;
+	void *arg;
+	struct job_counter *counter;
+};
+
+/* each field is atomic: a thief may read a slot the owner is reusing,
+ * it only keeps the job if it wins the top of the deque */
+struct job_slot {
+	_Atomic(job_func_t *) func;
+	_Atomic(void *) arg;
+	_Atomic(struct job_counter *) counter;
+};
+
+struct job_deque {
+	_Alignas(JOB_CACHE_LINE) atomic_long top; /* stolen from */
+	_Alignas(JOB_CACHE_LINE) atomic_long bottom; /* owner side */
+	struct job_slot slot[JOB_DEQUE_SIZE];
+};
+
+struct job_worker {
+	struct job_pool *pool;
+	pthread_t thread;
+	struct memory_zone scratch;
+	struct job_deque deque;
+	int index; /* -1 for the thread that made the pool */
+};
+
+struct job_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t wake; /* a job was pushed, or the pool is closing */
+	pthread_cond_t done; /* a job finished */
+	atomic_int queued; /* pushed and not taken yet, may briefly go below 0 */
+	atomic_uint pending; /* queued or running jobs */
+	atomic_uint sleeping, waiting; /* threads blocked on wake, on done */
+	int quit;
+	int thread_count;
+	struct job_worker caller;
+	struct job_worker workers[JOB_MAX_THREADS];
+};
+
+/* Start up to thread_count workers, the scratch zones are carved out of
+ * zone and given back by job_pool_fini. The zone is split between the
+ * workers and the calling thread, size it for (thread_count + 1) *
+ * JOB_MIN_SCRATCH: a smaller zone starts fewer workers, with a warning,
+ * and always at least one. */
+void job_pool_init(struct job_pool *pool, struct memory_zone *zone, int thread_count);
+void job_pool_fini(struct job_pool *pool);
+
+void job_push(struct job_pool *pool, job_func_t *func, void *arg);
+/* wait for every pushed job to be done, from the thread that made the
+ * pool only */
+void job_wait(struct job_pool *pool);
+
+void job_counter_init(struct job_counter *counter);
+/* push a job counted by counter */
+void job_push_counter(struct job_pool *pool, job_func_t *func, void *arg, struct job_counter *counter);
+/* wait for the jobs counted by counter, running jobs meanwhile: a job may
+ * wait for the jobs it pushed */
+void job_wait_counter(struct job_pool *pool, struct job_counter *counter);
+
+/* serialize accesses to data shared by the jobs, eg. a memory zone */
+void job_lock(struct job_pool *pool);
+void job_unlock(struct job_pool *pool);
+
+int job_cpu_count(void);
+/* monotonic wall clock time in seconds */
+double job_time(void);
+
+#endif
@@ -3,6 +3,35 @@
 #include "util.h"
 #include "math.h"
 
+/* Four floats wide operations, for the mat4 columns. SSE is always there
+ * on x86_64, wasm needs -msimd128. Without CONFIG_SIMD, or on any other
+ * target, the scalar code is used. */
+#if defined(CONFIG_SIMD) && defined(__SSE__)
+#include <xmmintrin.h>
+#define MATH_SIMD
+typedef __m128 f32x4;
+#define f32x4_load(p)     _mm_loadu_ps(p)
+#define f32x4_store(p, v) _mm_storeu_ps(p, v)
+#define f32x4_splat(s)    _mm_set1_ps(s)
+#define f32x4_add(a, b)   _mm_add_ps(a, b)
+#define f32x4_mul(a, b)   _mm_mul_ps(a, b)
+#define f32x4_lt(a, b)    _mm_cmplt_ps(a, b)
+#define f32x4_or(a, b)    _mm_or_ps(a, b)
+#define f32x4_mask(a)     _mm_movemask_ps(a)
+#elif defined(CONFIG_SIMD) && defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define MATH_SIMD
+typedef v128_t f32x4;
+#define f32x4_load(p)     wasm_v128_load(p)
+#define f32x4_store(p, v) wasm_v128_store(p, v)
+#define f32x4_splat(s)    wasm_f32x4_splat(s)
+#define f32x4_add(a, b)   wasm_f32x4_add(a, b)
+#define f32x4_mul(a, b)   wasm_f32x4_mul(a, b)
+#define f32x4_lt(a, b)    wasm_f32x4_lt(a, b)
+#define f32x4_or(a, b)    wasm_v128_or(a, b)
+#define f32x4_mask(a)     wasm_i32x4_bitmask(a)
+#endif
+
 #define VAL "%8.2f"
 #define SEP ", "
 
@@ -188,14 +217,48 @@ mat4 mat4_mult(mat4 *m, float s)
 	return r;
 }
 
+#ifdef MATH_SIMD
+/* linear combination of the columns of m: m * (v[0], v[1], v[2], v[3]) */
+static inline f32x4
+mat4_combine(const f32x4 col[4], const float *v)
+{
+	f32x4 r;
+
+	r = f32x4_mul(col[0], f32x4_splat(v[0]));
+	r = f32x4_add(r, f32x4_mul(col[1], f32x4_splat(v[1])));
+	r = f32x4_add(r, f32x4_mul(col[2], f32x4_splat(v[2])));
+	r = f32x4_add(r, f32x4_mul(col[3], f32x4_splat(v[3])));
+
+	return r;
+}
+
+static inline void
+mat4_load(f32x4 col[4], const mat4 *m)
+{
+	col[0] = f32x4_load(m->m[0]);
+	col[1] = f32x4_load(m->m[1]);
+	col[2] = f32x4_load(m->m[2]);
+	col[3] = f32x4_load(m->m[3]);
+}
+#endif
+
 vec4 mat4_mult_vec4(mat4 *m, vec4 v)
 {
 	vec4 r;
-
+#ifdef MATH_SIMD
+	float in[4] = { v.x, v.y, v.z, v.w };
+	float out[4];
+	f32x4 col[4];
+
+	mat4_load(col, m);
+	f32x4_store(out, mat4_combine(col, in));
+	r = (vec4){ out[0], out[1], out[2], out[3] };
+#else
 	r.x = m->m[0][0] * v.x + m->m[1][0] * v.y + m->m[2][0] * v.z + m->m[3][0] * v.w;
 	r.y = m->m[0][1] * v.x + m->m[1][1] * v.y + m->m[2][1] * v.z + m->m[3][1] * v.w;
 	r.z = m->m[0][2] * v.x + m->m[1][2] * v.y + m->m[2][2] * v.z + m->m[3][2] * v.w;
 	r.w = m->m[0][3] * v.x + m->m[1][3] * v.y + m->m[2][3] * v.z + m->m[3][3] * v.w;
+#endif
 
 	return r;
 }
@@ -211,9 +274,76 @@ vec3 mat4_mult_vec3(mat4 *m, vec3 v)
 	return r;
 }
 
+/* see mat4_mult_vec3, the rotation part is transposed once for all the
+ * points */
+void mat4_mult_vec3_batch(mat4 *m, const vec3 *v, vec3 *r, size_t count)
+{
+#ifdef MATH_SIMD
+	float t[4][4] = {
+		{ m->m[0][0], m->m[1][0], m->m[2][0], 0 },
+		{ m->m[0][1], m->m[1][1], m->m[2][1], 0 },
+		{ m->m[0][2], m->m[1][2], m->m[2][2], 0 },
+		{ m->m[3][0], m->m[3][1], m->m[3][2], 0 },
+	};
+	f32x4 col[4];
+	float out[4];
+	size_t i;
+
+	col[0] = f32x4_load(t[0]);
+	col[1] = f32x4_load(t[1]);
+	col[2] = f32x4_load(t[2]);
+	col[3] = f32x4_load(t[3]);
+	for (i = 0; i < count; i++) {
+		float in[4] = { v[i].x, v[i].y, v[i].z, 1 };
+
+		f32x4_store(out, mat4_combine(col, in));
+		r[i] = (vec3){ out[0], out[1], out[2] };
+	}
+#else
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		r[i] = mat4_mult_vec3(m, v[i]);
+#endif
+}
+
+void mat4_mult_mat4_batch(mat4 *a, const mat4 *b, mat4 *r, size_t count)
+{
+#ifdef MATH_SIMD
+	f32x4 col[4];
+	mat4 t;
+	size_t i;
+
+	mat4_load(col, a);
+	for (i = 0; i < count; i++) {
+		/* b and r may overlap */
+		f32x4_store(t.m[0], mat4_combine(col, b[i].m[0]));
+		f32x4_store(t.m[1], mat4_combine(col, b[i].m[1]));
+		f32x4_store(t.m[2], mat4_combine(col, b[i].m[2]));
+		f32x4_store(t.m[3], mat4_combine(col, b[i].m[3]));
+		r[i] = t;
+	}
+#else
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		r[i] = mat4_mult_mat4(a, (mat4 *) &b[i]);
+#endif
+}
+
 mat4 mat4_mult_mat4(mat4 *a, mat4 *b)
 {
 	mat4 r;
+#ifdef MATH_SIMD
+	f32x4 col[4];
+
+	/* each column of the result combines the columns of a */
+	mat4_load(col, a);
+	f32x4_store(r.m[0], mat4_combine(col, b->m[0]));
+	f32x4_store(r.m[1], mat4_combine(col, b->m[1]));
+	f32x4_store(r.m[2], mat4_combine(col, b->m[2]));
+	f32x4_store(r.m[3], mat4_combine(col, b->m[3]));
+#else
 	/* short notation for matrix access:
 	 * declare two pointers to an array of 4 floats */
 	const float (*const am)[4] = a->m;
@@ -235,6 +365,7 @@ mat4 mat4_mult_mat4(mat4 *a, mat4 *b)
 	r.m[3][1] = am[0][1] * bm[3][0] + am[1][1] * bm[3][1] + am[2][1] * bm[3][2] + am[3][1] * bm[3][3];
 	r.m[3][2] = am[0][2] * bm[3][0] + am[1][2] * bm[3][1] + am[2][2] * bm[3][2] + am[3][2] * bm[3][3];
 	r.m[3][3] = am[0][3] * bm[3][0] + am[1][3] * bm[3][1] + am[2][3] * bm[3][2] + am[3][3] * bm[3][3];
+#endif
 
 	return r;
 }
@@ -310,6 +441,53 @@ sphere_outside_frustum(vec4 planes[6], vec3 center, float radius)
 	return 0;
 }
 
+void
+spheres_in_frustum(vec4 planes[6], const float *x, const float *y, const float *z,
+		   const float *r, size_t count, uint32_t *visible)
+{
+	size_t i = 0;
+	int p;
+
+	memset(visible, 0, (count + 31) / 32 * sizeof(*visible));
+#ifdef MATH_SIMD
+	f32x4 px[6], py[6], pz[6], pw[6];
+	f32x4 cx, cy, cz, cr, d, out;
+	f32x4 zero = f32x4_splat(0);
+
+	for (p = 0; p < 6; p++) {
+		px[p] = f32x4_splat(planes[p].x);
+		py[p] = f32x4_splat(planes[p].y);
+		pz[p] = f32x4_splat(planes[p].z);
+		pw[p] = f32x4_splat(planes[p].w);
+	}
+
+	/* four spheres against all the planes, no early out */
+	for (; i + 4 <= count; i += 4) {
+		cx = f32x4_load(&x[i]);
+		cy = f32x4_load(&y[i]);
+		cz = f32x4_load(&z[i]);
+		cr = f32x4_load(&r[i]);
+		out = f32x4_lt(zero, zero);
+		for (p = 0; p < 6; p++) {
+			/* same operation order as plane_signed_distance */
+			d = f32x4_add(f32x4_mul(px[p], cx), f32x4_mul(py[p], cy));
+			d = f32x4_add(d, f32x4_mul(pz[p], cz));
+			d = f32x4_add(f32x4_add(d, pw[p]), cr);
+			out = f32x4_or(out, f32x4_lt(d, zero));
+		}
+		/* i is a multiple of 4, the bits never straddle two words */
+		visible[i / 32] |= (uint32_t) (~f32x4_mask(out) & 0xf) << (i % 32);
+	}
+#endif
+	for (; i < count; i++) {
+		for (p = 0; p < 6; p++)
+			if (plane_signed_distance(planes[p], (vec3){ x[i], y[i], z[i] }) + r[i] < 0)
+				break;
+		if (p == 6)
+			visible[i / 32] |= 1u << (i % 32);
+	}
+}
+
 void load_rot4(mat4 *d, vec3 axis, float angle) {
 	float s = sin(angle), c = cos(angle), v = 1 - c;
 	float xv, xs, yv, ys, zv, zs;
@@ -368,6 +546,12 @@ mat4 mat4_transform_scale(vec3 position, quaternion rotation, vec3 scale)
 
 	quaternion_to_mat4(&r, rotation);
 
+#ifdef MATH_SIMD
+	/* the last row is 0, scaled or not */
+	f32x4_store(r.m[0], f32x4_mul(f32x4_load(r.m[0]), f32x4_splat(scale.x)));
+	f32x4_store(r.m[1], f32x4_mul(f32x4_load(r.m[1]), f32x4_splat(scale.y)));
+	f32x4_store(r.m[2], f32x4_mul(f32x4_load(r.m[2]), f32x4_splat(scale.z)));
+#else
 	r.m[0][0] *= scale.x;
 	r.m[0][1] *= scale.x;
 	r.m[0][2] *= scale.x;
@@ -379,6 +563,7 @@ mat4 mat4_transform_scale(vec3 position, quaternion rotation, vec3 scale)
 	r.m[2][0] *= scale.z;
 	r.m[2][1] *= scale.z;
 	r.m[2][2] *= scale.z;
+#endif
 
 	r.m[3][0] = position.x;
 	r.m[3][1] = position.y;
@@ -1,6 +1,8 @@
 #ifndef MATH_H
 #define MATH_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <math.h>
 
 typedef struct vec3_t {
@@ -177,6 +179,16 @@ vec3_fma(vec3 u, vec3 v, vec3 w)
 	return r;
 }
 
+/* vec3_lerp
+   Semantic: linear interpolation, u for t = 0 and v for t = 1
+*/
+static inline vec3
+vec3_lerp(vec3 u, vec3 v, float t)
+{
+	vec3 r = { u.x + t * (v.x - u.x), u.y + t * (v.y - u.y), u.z + t * (v.z - u.z) };
+	return r;
+}
+
 /* vec3_cross
    Specification:
    Take two vec3 u and v and return a vec3
@@ -377,6 +389,14 @@ vec4 mat4_mult_vec4(mat4 *m, vec4 v);
 vec3 mat4_mult_vec3(mat4 *m, vec3 v);
 mat4 mat4_mult_mat4(mat4 *a, mat4 *b);
 
+/* mat4_mult_vec3_batch, mat4_mult_mat4_batch
+   Semantic: r[i] = m * v[i] and r[i] = a * b[i] for count elements,
+   the same as calling mat4_mult_vec3 or mat4_mult_mat4 on each of them,
+   with m or a loaded once. r may be the input array.
+*/
+void mat4_mult_vec3_batch(mat4 *m, const vec3 *v, vec3 *r, size_t count);
+void mat4_mult_mat4_batch(mat4 *a, const mat4 *b, mat4 *r, size_t count);
+
 /* mat4_projection_frustum
    Specification: Takes a projection matrix and return the frustum planes.
    Semantic: extract from a projection matrix 6 planes corresponsing
@@ -398,6 +418,17 @@ float plane_signed_distance(vec4 plane, vec3 point);
  */
 int sphere_outside_frustum(vec4 planes[6], vec3 center, float radius);
 
+/* spheres_in_frustum
+   Specification: Take frustum planes and count spheres, as arrays of
+   center coordinates and radii, and fill the visible bitmask of
+   (count + 31) / 32 words.
+   Semantic: bit i % 32 of visible[i / 32] is set when the sphere i is
+   not outside of the frustum, the same as sphere_outside_frustum, the
+   spheres are tested four at a time.
+ */
+void spheres_in_frustum(vec4 planes[6], const float *x, const float *y, const float *z,
+			const float *r, size_t count, uint32_t *visible);
+
 /* Quaternions and Rotations */
 
 /* print_quaternion
@@ -1,23 +1,26 @@
 #include "engine.h"
 
+/* positions are 3 floats every stride bytes */
 static struct bounding_volume
-bounding_volume(size_t count, float *positions)
+bounding_volume(size_t count, size_t stride, float *positions)
 {
 	struct bounding_volume bvol = { 0 };
 	float len, max = 0;
 	unsigned int i;
+	float *p;
 	vec3 pos;
 
 	if (!positions)
 		return bvol;
 
 	for (i = 0; i < count; i++) {
-		bvol.min.x = MIN(bvol.min.x, positions[i * 3 + 0]);
-		bvol.min.y = MIN(bvol.min.y, positions[i * 3 + 1]);
-		bvol.min.z = MIN(bvol.min.z, positions[i * 3 + 2]);
-		bvol.max.x = MAX(bvol.max.x, positions[i * 3 + 0]);
-		bvol.max.y = MAX(bvol.max.y, positions[i * 3 + 1]);
-		bvol.max.z = MAX(bvol.max.z, positions[i * 3 + 2]);
+		p = (void *)positions + i * stride;
+		bvol.min.x = MIN(bvol.min.x, p[0]);
+		bvol.min.y = MIN(bvol.min.y, p[1]);
+		bvol.min.z = MIN(bvol.min.z, p[2]);
+		bvol.max.x = MAX(bvol.max.x, p[0]);
+		bvol.max.y = MAX(bvol.max.y, p[1]);
+		bvol.max.z = MAX(bvol.max.z, p[2]);
 	}
 
 	/* full extent from one corner to the other */
@@ -26,9 +29,10 @@ bounding_volume(size_t count, float *positions)
 	bvol.off = vec3_add(bvol.ext, bvol.min);
 
 	for (i = 0; i < count; i++) {
-		pos.x = positions[i * 3 + 0];
-		pos.y = positions[i * 3 + 1];
-		pos.z = positions[i * 3 + 2];
+		p = (void *)positions + i * stride;
+		pos.x = p[0];
+		pos.y = p[1];
+		pos.z = p[2];
 
 		/* distance to the bounding volume's center */
 		pos = vec3_sub(pos, bvol.off);
@@ -57,32 +61,147 @@ mesh_load(struct mesh *m, size_t count, GLenum primitive, float *positions, floa
 
 	m->vbo_count = vbo_count;
 	m->vertex_count = count;
+	m->vertex_size = 0;
 	m->index_count = 0;
+	m->instances = 0;
 
 	if (positions) {
 		glBindBuffer(GL_ARRAY_BUFFER, m->vbo[m->idx_positions]);
 		glBufferData(GL_ARRAY_BUFFER, m->vertex_count * 3 * sizeof(float), positions, GL_STATIC_DRAW);
+		glVertexAttribPointer(MESH_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(MESH_ATTRIB_POSITION);
 	}
 
 	if (normals) {
 		glBindBuffer(GL_ARRAY_BUFFER, m->vbo[m->idx_normals]);
 		glBufferData(GL_ARRAY_BUFFER, m->vertex_count * 3 * sizeof(float), normals, GL_STATIC_DRAW);
+		glVertexAttribPointer(MESH_ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(MESH_ATTRIB_NORMAL);
 	}
 
 	if (texcoords) {
 		glBindBuffer(GL_ARRAY_BUFFER, m->vbo[m->idx_texcoords]);
 		glBufferData(GL_ARRAY_BUFFER, m->vertex_count * 2 * sizeof(float), texcoords, GL_STATIC_DRAW);
+		glVertexAttribPointer(MESH_ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(MESH_ATTRIB_TEXCOORD);
 	}
 
 	glBindVertexArray(0);
 
-	m->bounding = bounding_volume(count, positions);
+	m->bounding = bounding_volume(count, 3 * sizeof(float), positions);
 	m->primitive = primitive;
 }
 
 void
-mesh_index(struct mesh *m, size_t index_count, unsigned int *indices)
+mesh_load_packed(struct mesh *m, size_t count, GLenum primitive, struct mesh_vertex *vertices)
 {
+	GLsizei stride = sizeof(*vertices);
+
+	glGenVertexArrays(1, &m->vao);
+	glBindVertexArray(m->vao);
+
+	/* every attribute lives in the same buffer */
+	m->idx_positions = 0;
+	m->idx_normals   = 0;
+	m->idx_texcoords = 0;
+
+	glGenBuffers(1, m->vbo);
+
+	m->vbo_count = 1;
+	m->vertex_count = count;
+	m->vertex_size = stride;
+	m->index_count = 0;
+	m->instances = 0;
+
+	glBindBuffer(GL_ARRAY_BUFFER, m->vbo[0]);
+	glBufferData(GL_ARRAY_BUFFER, count * stride, vertices, GL_STATIC_DRAW);
+
+	glVertexAttribPointer(MESH_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, stride,
+			      (void *)offsetof(struct mesh_vertex, position));
+	glEnableVertexAttribArray(MESH_ATTRIB_POSITION);
+	glVertexAttribPointer(MESH_ATTRIB_NORMAL, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride,
+			      (void *)offsetof(struct mesh_vertex, normal));
+	glEnableVertexAttribArray(MESH_ATTRIB_NORMAL);
+	glVertexAttribPointer(MESH_ATTRIB_TEXCOORD, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+			      (void *)offsetof(struct mesh_vertex, texcoord));
+	glEnableVertexAttribArray(MESH_ATTRIB_TEXCOORD);
+
+	glBindVertexArray(0);
+
+	m->bounding = bounding_volume(count, stride, vertices->position);
+	m->primitive = primitive;
+}
+
+struct bounding_volume
+mesh_bounding(size_t count, struct mesh_vertex *vertices)
+{
+	return bounding_volume(count, sizeof(*vertices), vertices->position);
+}
+
+static uint16_t
+pack_half(float f)
+{
+	union { float f; uint32_t u; } v = { f };
+	uint32_t sign = (v.u >> 16) & 0x8000;
+	int32_t exp = (int32_t)((v.u >> 23) & 0xff) - 127 + 15;
+	uint32_t mant = v.u & 0x7fffff;
+
+	/* too small for a normal half, flush to zero */
+	if (exp <= 0)
+		return sign;
+
+	/* round to nearest, may carry into the exponent */
+	mant += 0x1000;
+	if (mant & 0x800000) {
+		mant = 0;
+		exp++;
+	}
+
+	/* too large, or inf and nan: clamp to infinity */
+	if (exp >= 31)
+		return sign | 0x7c00;
+
+	return sign | (exp << 10) | (mant >> 13);
+}
+
+static uint32_t
+pack_snorm10(float f)
+{
+	f = MIN(1.0, MAX(-1.0, f));
+
+	return (uint32_t)(int32_t)floorf(f * 511.0 + 0.5) & 0x3ff;
+}
+
+void
+mesh_pack(struct mesh_vertex *out, size_t count, float *positions, float *normals, float *texcoords)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		out[i].position[0] = positions[i * 3 + 0];
+		out[i].position[1] = positions[i * 3 + 1];
+		out[i].position[2] = positions[i * 3 + 2];
+
+		out[i].normal = 0;
+		if (normals) {
+			out[i].normal |= pack_snorm10(normals[i * 3 + 0]) << 0;
+			out[i].normal |= pack_snorm10(normals[i * 3 + 1]) << 10;
+			out[i].normal |= pack_snorm10(normals[i * 3 + 2]) << 20;
+		}
+
+		out[i].texcoord[0] = 0;
+		out[i].texcoord[1] = 0;
+		if (texcoords) {
+			out[i].texcoord[0] = pack_half(texcoords[i * 2 + 0]);
+			out[i].texcoord[1] = pack_half(texcoords[i * 2 + 1]);
+		}
+	}
+}
+
+void
+mesh_index(struct mesh *m, size_t index_count, GLenum type, void *indices)
+{
+	size_t size = (type == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(unsigned int);
 
 	if (!indices)
 		return;
@@ -94,35 +213,50 @@ mesh_index(struct mesh *m, size_t index_count, unsigned int *indices)
 	glGenBuffers(1, &m->vbo[m->idx_indices]);
 
 	m->index_count = index_count;
+	m->index_type = type;
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->vbo[m->idx_indices]);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m->index_count * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m->index_count * size, indices, GL_STATIC_DRAW);
 
 	glBindVertexArray(0);
 }
 
 void
-mesh_bind(struct mesh *m, GLint position, GLint normal, GLint texture)
+mesh_bind(struct mesh *m)
 {
+	/* the vertex layout is already recorded in the VAO */
 	glBindVertexArray(m->vao);
+}
 
-	if (position >= 0) {
-		glBindBuffer(GL_ARRAY_BUFFER, m->vbo[m->idx_positions]);
-		glVertexAttribPointer(position, 3, GL_FLOAT, GL_FALSE, 0, 0);
-		glEnableVertexAttribArray(position);
-	}
+void
+mesh_bind_instanced(struct mesh *m, GLuint instances)
+{
+	GLsizei stride = sizeof(struct mesh_instance);
+	GLuint model = MESH_ATTRIB_MODEL;
+	GLuint color = MESH_ATTRIB_COLOR;
+	size_t offset;
+	int i;
 
-	if (normal >= 0) {
-		glBindBuffer(GL_ARRAY_BUFFER, m->vbo[m->idx_normals]);
-		glVertexAttribPointer(normal, 3, GL_FLOAT, GL_FALSE, 0, 0);
-		glEnableVertexAttribArray(normal);
-	}
+	mesh_bind(m);
 
-	if (texture >= 0) {
-		glBindBuffer(GL_ARRAY_BUFFER, m->vbo[m->idx_texcoords]);
-		glVertexAttribPointer(texture, 2, GL_FLOAT, GL_FALSE, 0, 0);
-		glEnableVertexAttribArray(texture);
+	if (m->instances == instances)
+		return;
+	m->instances = instances;
+
+	glBindBuffer(GL_ARRAY_BUFFER, instances);
+
+	/* one attribute location per matrix column */
+	for (i = 0; i < 4; i++) {
+		offset = offsetof(struct mesh_instance, model) + i * sizeof(vec4);
+		glVertexAttribPointer(model + i, 4, GL_FLOAT, GL_FALSE, stride, (void *)offset);
+		glVertexAttribDivisor(model + i, 1);
+		glEnableVertexAttribArray(model + i);
 	}
+
+	offset = offsetof(struct mesh_instance, color);
+	glVertexAttribPointer(color, 3, GL_FLOAT, GL_FALSE, stride, (void *)offset);
+	glVertexAttribDivisor(color, 1);
+	glEnableVertexAttribArray(color);
 }
 
 void
@@ -369,7 +503,7 @@ mesh_load_torus(struct mesh *m, float circle_radius, float radial_radius,
 	}
 
 	mesh_load(m, vert_count, GL_TRIANGLE_STRIP, positions, normals, texcoords);
-	mesh_index(m, ARRAY_LEN(indices), indices);
+	mesh_index(m, ARRAY_LEN(indices), GL_UNSIGNED_INT, indices);
 }
 
 void
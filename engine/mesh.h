@@ -1,9 +1,13 @@
 #ifndef MESH_H
 #define MESH_H
 
+/* Vertex attributes use fixed locations, shaders get them bound before
+ * linking, so the vertex layout is recorded in the VAO at load time. */
 #define MESH_ATTRIB_POSITION 0
 #define MESH_ATTRIB_NORMAL   1
 #define MESH_ATTRIB_TEXCOORD 2
+#define MESH_ATTRIB_MODEL    3 /* mat4, use 4 locations: 3 to 6 */
+#define MESH_ATTRIB_COLOR    7
 #define MESH_MAX_VBO 4
 
 struct mesh {
@@ -15,7 +19,9 @@ struct mesh {
 	int idx_texcoords;
 	int idx_indices;
 	size_t vertex_count;
+	size_t vertex_size; /* stride of the vertex buffer, 0 if not interleaved */
 	size_t index_count;
+	GLenum index_type; /* GL_UNSIGNED_SHORT or GL_UNSIGNED_INT */
 	GLenum primitive;
 	struct bounding_volume {
 		vec3 min;
@@ -25,6 +31,24 @@ struct mesh {
 		float radius; /* bounding sphere radius */
 	} bounding;
 	float *positions;
+	unsigned int *indices;
+	struct bvh bvh; /* over positions, for ray casts */
+	GLuint instances; /* instance buffer recorded in the VAO */
+};
+
+/* Interleaved and packed vertex: 20 bytes instead of 32 for separate float
+ * arrays. The normal is a signed normalized GL_INT_2_10_10_10_REV and the
+ * texture coordinates are half floats. */
+struct mesh_vertex {
+	float position[3];
+	uint32_t normal;
+	uint16_t texcoord[2];
+};
+
+/* per-instance attributes streamed by mesh_bind_instanced */
+struct mesh_instance {
+	mat4 model;
+	vec3 color;
 };
 
 /** mesh_load
@@ -53,8 +77,29 @@ struct mesh {
      using load_obj. (see asset.h).
 */
 void mesh_load(struct mesh *m, size_t count, GLenum primitive, float *positions, float *normals, float *texcoords);
-void mesh_index(struct mesh *m, size_t count, unsigned int *index);
-void mesh_bind(struct mesh *m, GLint position, GLint normal, GLint texture);
+/** mesh_index
+   Load an index buffer for the mesh, type is the type of the indices, either
+   GL_UNSIGNED_SHORT (uint16_t) or GL_UNSIGNED_INT (unsigned int).
+*/
+void mesh_index(struct mesh *m, size_t count, GLenum type, void *indices);
+/** mesh_load_packed
+   Same as mesh_load but the vertices are interleaved in a single vertex
+   buffer, see mesh_pack to build the vertices from float arrays.
+*/
+void mesh_load_packed(struct mesh *m, size_t count, GLenum primitive, struct mesh_vertex *vertices);
+/* bounding volume of packed vertices, as computed by mesh_load_packed */
+struct bounding_volume mesh_bounding(size_t count, struct mesh_vertex *vertices);
+void mesh_pack(struct mesh_vertex *out, size_t count, float *positions, float *normals, float *texcoords);
+void mesh_bind(struct mesh *m);
+/** mesh_bind_instanced
+   Same as mesh_bind, plus per-instance attributes sourced from the buffer
+   instances, which holds an array of struct mesh_instance.
+   Instance attributes advance once per instance (divisor of 1), the mesh
+   can then be drawn with glDraw*Instanced.
+   The instance attributes are only specified the first time a buffer is
+   bound to the mesh, after that they are part of the VAO state.
+*/
+void mesh_bind_instanced(struct mesh *m, GLuint instances);
 void mesh_free(struct mesh *m);
 void mesh_load_box(struct mesh *m, float x, float y, float z);
 void mesh_load_quad(struct mesh *m, float x, float y);
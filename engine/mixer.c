@@ -0,0 +1,300 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "engine.h"
+
+static void *
+mixer_push_zone(struct memory_zone *zone, size_t size)
+{
+	/* keep the voices on their own cache lines */
+	uintptr_t addr = (uintptr_t) zone->base + zone->used;
+
+	mempush(zone, -addr & (RING_BUFFER_CACHE_LINE - 1));
+
+	return memset(mempush(zone, size), 0, size);
+}
+
+void
+mixer_init(struct mixer *mixer, struct memory_zone *zone, unsigned int voices,
+	   unsigned int sounds, float volume)
+{
+	unsigned int i;
+
+	memset(mixer, 0, sizeof(*mixer));
+	atomic_init(&mixer->head, 0);
+	atomic_init(&mixer->tail, 0);
+	mixer->volume = volume;
+
+	mixer->voice = mixer_push_zone(zone, voices * sizeof(*mixer->voice));
+	mixer->active = mixer_push_zone(zone, voices * sizeof(*mixer->active));
+	mixer->free = mixer_push_zone(zone, voices * sizeof(*mixer->free));
+	mixer->voice_count = voices;
+	for (i = 0; i < voices; i++)
+		mixer->free[i] = voices - 1 - i;
+	mixer->free_count = voices;
+
+	mixer->sound = mixer_push_zone(zone, sounds * sizeof(*mixer->sound));
+	mixer->sound_count = sounds;
+}
+
+void
+mixer_sound(struct mixer *mixer, unsigned int key, struct mixer_sound sound)
+{
+	if (key >= mixer->sound_count)
+		die("mixer: Sound %u out of range\n", key);
+
+	mixer->sound[key] = sound;
+}
+
+static void
+mixer_cmd_push(struct mixer *mixer, struct mixer_cmd *cmd)
+{
+	unsigned int head = atomic_load_explicit(&mixer->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&mixer->tail, memory_order_acquire);
+
+	if (head - tail >= MIXER_QUEUE_SIZE) {
+		mixer->dropped++;
+		return;
+	}
+
+	mixer->queue[head % MIXER_QUEUE_SIZE] = *cmd;
+
+	/* publish the command after it is written */
+	atomic_store_explicit(&mixer->head, head + 1, memory_order_release);
+}
+
+unsigned int
+mixer_play(struct mixer *mixer, unsigned int key, float gain, float pan)
+{
+	/* 0 is never a voice id, see mixer_cmd */
+	if (++mixer->next_id == 0)
+		++mixer->next_id;
+
+	mixer_cmd_push(mixer, &(struct mixer_cmd){
+		.type = MIXER_PLAY,
+		.voice = mixer->next_id,
+		.sound = key,
+		.value = gain,
+		.pan = pan,
+	});
+
+	return mixer->next_id;
+}
+
+void
+mixer_push(struct mixer *mixer, enum mixer_cmd_type type, unsigned int voice, float value)
+{
+	if (voice == 0)
+		return;
+
+	mixer_cmd_push(mixer, &(struct mixer_cmd){
+		.type = type,
+		.voice = voice,
+		.value = value,
+	});
+}
+
+void
+mixer_push_group(struct mixer *mixer, enum mixer_cmd_type type, unsigned int group, float value)
+{
+	mixer_cmd_push(mixer, &(struct mixer_cmd){
+		.type = type,
+		.group = group,
+		.value = value,
+	});
+}
+
+/* the active voice to give up for a new one of the given priority: the
+ * lowest priority, then the oldest, -1 if they all rank higher */
+static int
+mixer_steal(struct mixer *mixer, int priority)
+{
+	struct mixer_voice *voice, *best = NULL;
+	int i, found = -1;
+
+	for (i = 0; i < (int) mixer->active_count; i++) {
+		voice = &mixer->voice[mixer->active[i]];
+		if (voice->priority > priority)
+			continue;
+		if (!best || voice->priority < best->priority ||
+		    (voice->priority == best->priority && (int) (voice->id - best->id) < 0)) {
+			best = voice;
+			found = i;
+		}
+	}
+
+	return found;
+}
+
+/* remove the nth active voice, the order of the active list does not
+ * matter */
+static void
+mixer_release(struct mixer *mixer, unsigned int n)
+{
+	unsigned int index = mixer->active[n];
+
+	mixer->voice[index].id = 0;
+	mixer->active[n] = mixer->active[--mixer->active_count];
+	mixer->free[mixer->free_count++] = index;
+}
+
+static void
+mixer_start(struct mixer *mixer, struct mixer_cmd *cmd)
+{
+	struct mixer_sound *sound;
+	struct mixer_voice *voice;
+	unsigned int index;
+	int n;
+
+	if (cmd->sound >= mixer->sound_count || !mixer->sound[cmd->sound].wav)
+		return;
+	sound = &mixer->sound[cmd->sound];
+
+	if (mixer->free_count == 0) {
+		n = mixer_steal(mixer, sound->priority);
+		if (n < 0) {
+			mixer->refused++;
+			return;
+		}
+		mixer_release(mixer, n);
+		mixer->stolen++;
+	}
+
+	index = mixer->free[--mixer->free_count];
+	mixer->active[mixer->active_count++] = index;
+
+	voice = &mixer->voice[index];
+	voice->id = cmd->voice;
+	voice->group = sound->group;
+	voice->priority = sound->priority;
+	voice->sound_gain = sound->gain;
+	voice->gain = sound->gain * cmd->value;
+	voice->pan = cmd->pan;
+	voice->paused = 0;
+
+	sampler_init(&voice->sampler, sound->wav);
+	voice->sampler.loop_on = sound->loop_on;
+	voice->sampler.loop_start = sound->loop_start;
+	voice->sampler.trig_on = 1;
+	/* set up again on the first render, with a clean history */
+	voice->resampler.src_rate = 0;
+	voice->resampler.tail = 0;
+}
+
+static void
+mixer_apply_voice(struct mixer *mixer, unsigned int n, struct mixer_cmd *cmd)
+{
+	struct mixer_voice *voice = &mixer->voice[mixer->active[n]];
+
+	switch (cmd->type) {
+	case MIXER_PLAY:
+		break;
+	case MIXER_STOP:
+		mixer_release(mixer, n);
+		break;
+	case MIXER_PAUSE:
+		voice->paused = (cmd->value != 0);
+		break;
+	case MIXER_VOLUME:
+		voice->gain = voice->sound_gain * cmd->value;
+		break;
+	case MIXER_PAN:
+		voice->pan = cmd->value;
+		break;
+	}
+}
+
+static void
+mixer_apply(struct mixer *mixer, struct mixer_cmd *cmd)
+{
+	struct mixer_voice *voice;
+	unsigned int n;
+
+	if (cmd->type == MIXER_PLAY) {
+		mixer_start(mixer, cmd);
+		return;
+	}
+
+	/* backward, a stop moves the last voice in place of the current */
+	for (n = mixer->active_count; n-- > 0;) {
+		voice = &mixer->voice[mixer->active[n]];
+		if (cmd->voice ? voice->id == cmd->voice : voice->group == cmd->group)
+			mixer_apply_voice(mixer, n, cmd);
+	}
+}
+
+/* mix one voice into out, panned, return 0 once it is done playing */
+static int
+mixer_voice_render(struct mixer_voice *voice, float *out, size_t frames, unsigned int samplerate)
+{
+	float buf[2 * MIXER_BLOCK];
+	struct sampler *sampler = &voice->sampler;
+	unsigned int rate = sampler->wav->header.samplerate;
+	float l = voice->gain * MIN(1, 1 - voice->pan);
+	float r = voice->gain * MIN(1, 1 + voice->pan);
+	size_t len, n;
+
+	while (frames > 0) {
+		len = MIN(frames, MIXER_BLOCK);
+		memset(buf, 0, 2 * len * sizeof(float));
+		if (rate && samplerate && rate != samplerate)
+			resampler_render(&voice->resampler, sampler, buf, len, samplerate);
+		else
+			sampler_render(sampler, buf, len);
+
+		for (n = 0; n < len; n++) {
+			out[2 * n + 0] += l * buf[2 * n + 0];
+			out[2 * n + 1] += r * buf[2 * n + 1];
+		}
+		out += 2 * len;
+		frames -= len;
+	}
+
+	/* the resampler may still have to flush its filter */
+	return sampler->state == PLAY || sampler->trig_on || voice->resampler.tail > 0;
+}
+
+void
+mixer_render(struct mixer *mixer, struct audio *audio)
+{
+	unsigned int head = atomic_load_explicit(&mixer->head, memory_order_acquire);
+	unsigned int tail = atomic_load_explicit(&mixer->tail, memory_order_relaxed);
+	float *mix = (float *) audio->buffer; /* interleaved left and right */
+	size_t frames = audio->size;
+	double start = job_time();
+	unsigned int i, rate, resampled = 0, playing = 0;
+	struct mixer_voice *voice;
+	size_t n;
+
+	for (; tail != head; tail++)
+		mixer_apply(mixer, &mixer->queue[tail % MIXER_QUEUE_SIZE]);
+	atomic_store_explicit(&mixer->tail, tail, memory_order_release);
+
+	memset(mix, 0, frames * sizeof(*audio->buffer));
+	/* backward, a release moves the last voice in place of the current */
+	for (i = mixer->active_count; i-- > 0;) {
+		voice = &mixer->voice[mixer->active[i]];
+		if (voice->paused)
+			continue;
+		rate = voice->sampler.wav->header.samplerate;
+		if (rate && audio->samplerate && rate != audio->samplerate)
+			resampled++;
+		playing++;
+		if (!mixer_voice_render(voice, mix, frames, audio->samplerate))
+			mixer_release(mixer, i);
+	}
+	for (n = 0; n < 2 * frames; n++)
+		mix[n] *= mixer->volume;
+
+	/* decode streamed voices ahead for the next block */
+	for (i = 0; i < mixer->active_count; i++) {
+		voice = &mixer->voice[mixer->active[i]];
+		if (!voice->paused)
+			sampler_prefetch(&voice->sampler);
+	}
+
+	mixer->time += job_time() - start;
+	mixer->frames += frames;
+	mixer->voice_frames += playing * frames;
+	mixer->resampled = resampled;
+}
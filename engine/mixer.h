@@ -0,0 +1,99 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+/* The mixer owns a pool of voices and runs on the audio thread. The game
+ * drives it with commands sent through a lock-free single producer,
+ * single consumer queue: once the audio runs the game never touches the
+ * voices directly.
+ * Sounds are registered by key, each play takes a voice from the pool
+ * for as long as the sound plays. Only the active voices are mixed, when
+ * the pool is full the voice with the lowest priority, then the oldest,
+ * is stolen. */
+
+#define MIXER_QUEUE_SIZE 64 /* a power of two */
+#define MIXER_BLOCK      256 /* frames mixed at once per voice */
+
+enum mixer_cmd_type {
+	MIXER_PLAY,   /* take a voice to play a sound */
+	MIXER_STOP,   /* stop and give the voice back */
+	MIXER_PAUSE,  /* value 1 pauses, 0 resumes */
+	MIXER_VOLUME, /* value scales the gain of the sound, as the play gain does */
+	MIXER_PAN,    /* value -1 left, 0 center, 1 right */
+};
+
+/* how a sound plays, set once per key */
+struct mixer_sound {
+	struct wav *wav; /* when streamed, play it on one voice at a time */
+	float gain;
+	int priority; /* only stolen to play a sound of at least this priority */
+	unsigned int group; /* to pause or stop sounds together */
+	int loop_on;
+	size_t loop_start;
+};
+
+struct mixer_cmd {
+	enum mixer_cmd_type type;
+	unsigned int voice; /* voice id, 0 for every voice of the group */
+	unsigned int group;
+	unsigned int sound; /* MIXER_PLAY only */
+	float value;
+	float pan; /* MIXER_PLAY only */
+};
+
+struct mixer_voice {
+	struct sampler sampler;
+	/* used when the sound is not at the device samplerate */
+	struct resampler resampler;
+	unsigned int id; /* given by mixer_play, in play order */
+	unsigned int group;
+	int priority;
+	float sound_gain; /* of the sound, volumes apply on top of it */
+	float gain;
+	float pan;
+	unsigned char paused;
+};
+
+struct mixer {
+	/* the pool, in the memory zone given to mixer_init */
+	struct mixer_voice *voice;
+	unsigned int *active; /* indices of the voices in use */
+	unsigned int *free;
+	unsigned int voice_count, active_count, free_count;
+
+	struct mixer_sound *sound;
+	unsigned int sound_count;
+	unsigned int next_id; /* game side, last voice id given */
+	float volume; /* master volume */
+
+	struct mixer_cmd queue[MIXER_QUEUE_SIZE];
+	_Alignas(RING_BUFFER_CACHE_LINE) atomic_uint head; /* written by the game */
+	_Alignas(RING_BUFFER_CACHE_LINE) atomic_uint tail; /* written by the audio thread */
+	unsigned int dropped; /* commands lost to a full queue */
+
+	/* written by the audio thread, never reset */
+	unsigned int stolen; /* voices cut short by a new play */
+	unsigned int refused; /* plays lost to a pool full of higher priorities */
+	double time; /* spent mixing, in seconds */
+	size_t frames;
+	size_t voice_frames; /* frames rendered by each playing voice, summed */
+	unsigned int resampled; /* voices resampled in the last block */
+};
+
+/* the pool of voices and the sound table are carved out of zone */
+void mixer_init(struct mixer *mixer, struct memory_zone *zone, unsigned int voices,
+		unsigned int sounds, float volume);
+/* only to be called before the audio starts */
+void mixer_sound(struct mixer *mixer, unsigned int key, struct mixer_sound sound);
+
+/* game side, play the sound registered as key and return the id of the
+ * voice, usable until the sound ends or the voice is stolen */
+unsigned int mixer_play(struct mixer *mixer, unsigned int key, float gain, float pan);
+/* game side, queue a command for one voice */
+void mixer_push(struct mixer *mixer, enum mixer_cmd_type type, unsigned int voice, float value);
+/* game side, queue a command for every voice of a group */
+void mixer_push_group(struct mixer *mixer, enum mixer_cmd_type type, unsigned int group, float value);
+
+/* audio side, apply the queued commands then mix into the audio buffer */
+void mixer_render(struct mixer *mixer, struct audio *audio);
+
+#endif
@@ -0,0 +1,119 @@
+#include <string.h>
+
+#include "engine.h"
+
+#define PHASE_BITS 5 /* log2(RESAMPLER_PHASES) */
+
+static double
+sinc(double x)
+{
+	if (fabs(x) < 1e-9)
+		return 1;
+	return sin(M_PI * x) / (M_PI * x);
+}
+
+static void
+resampler_init(struct resampler *rs, unsigned int src, unsigned int dst)
+{
+	/* cut a bit below the lowest of the two nyquist frequencies */
+	double fc = 0.9 * MIN(1.0, dst / (double) src);
+	double half = RESAMPLER_TAPS / 2;
+	double t, w, sum;
+	int p, k;
+
+	for (p = 0; p <= RESAMPLER_PHASES; p++) {
+		sum = 0;
+		for (k = 0; k < RESAMPLER_TAPS; k++) {
+			/* distance from the interpolated point, which sits
+			 * between the taps half - 1 and half */
+			t = k - (half - 1) - p / (double) RESAMPLER_PHASES;
+			/* blackman window */
+			w = 0.42 + 0.5 * cos(M_PI * t / half) + 0.08 * cos(2 * M_PI * t / half);
+			rs->filter[p][k] = fc * sinc(fc * t) * w;
+			sum += rs->filter[p][k];
+		}
+		/* unity gain for every phase */
+		for (k = 0; k < RESAMPLER_TAPS; k++)
+			rs->filter[p][k] /= sum;
+	}
+
+	rs->src_rate = src;
+	rs->dst_rate = dst;
+	rs->step = ((uint64_t) src << 32) / dst;
+	rs->frac = 0;
+	rs->tail = 0;
+	memset(rs->history, 0, sizeof(rs->history));
+}
+
+/* one output sample, the coefficients are interpolated between two phases
+ * then applied with four partial sums to let the compiler vectorize */
+static float
+resampler_tap(const float *restrict x, const float *restrict f0, const float *restrict f1, float w)
+{
+	float acc[4] = { 0 };
+	int k, m;
+
+	for (k = 0; k < RESAMPLER_TAPS; k += 4)
+		for (m = 0; m < 4; m++)
+			acc[m] += x[k + m] * (f0[k + m] + w * (f1[k + m] - f0[k + m]));
+
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+void
+resampler_render(struct resampler *rs, struct sampler *sampler, float *out, size_t frames, unsigned int rate)
+{
+	float src[2 * RESAMPLER_BLOCK];
+	float buf[2][RESAMPLER_TAPS + RESAMPLER_BLOCK];
+	unsigned int src_rate = sampler->wav->header.samplerate;
+	uint64_t pos, end;
+	size_t n, need, i, j;
+	unsigned int p;
+	int playing;
+	float w;
+
+	if (rs->src_rate != src_rate || rs->dst_rate != rate)
+		resampler_init(rs, src_rate, rate);
+
+	while (frames > 0) {
+		/* nothing left to play nor to flush */
+		if (sampler->state == STOP && !sampler->trig_on && rs->tail == 0)
+			return;
+
+		/* as many output frames as the source block allows */
+		n = (((uint64_t) RESAMPLER_BLOCK << 32) - rs->frac) / rs->step;
+		n = MIN(MAX(n, 1), frames);
+		end = rs->frac + n * rs->step;
+		need = end >> 32;
+
+		/* run the sampler at the wav rate */
+		playing = sampler->state == PLAY || sampler->trig_on;
+		memset(src, 0, need * 2 * sizeof(float));
+		sampler_render(sampler, src, need);
+		if (playing || sampler->state == PLAY)
+			rs->tail = RESAMPLER_TAPS;
+		else
+			rs->tail -= MIN(rs->tail, need);
+
+		memcpy(buf[0], rs->history[0], sizeof(rs->history[0]));
+		memcpy(buf[1], rs->history[1], sizeof(rs->history[1]));
+		for (i = 0; i < need; i++) {
+			buf[0][RESAMPLER_TAPS + i] = src[2 * i + 0];
+			buf[1][RESAMPLER_TAPS + i] = src[2 * i + 1];
+		}
+
+		for (j = 0, pos = rs->frac; j < n; j++, pos += rs->step) {
+			i = pos >> 32;
+			p = (pos >> (32 - PHASE_BITS)) & (RESAMPLER_PHASES - 1);
+			w = (pos & ((1ULL << (32 - PHASE_BITS)) - 1)) / (float) (1ULL << (32 - PHASE_BITS));
+			out[2 * j + 0] += resampler_tap(&buf[0][i], rs->filter[p], rs->filter[p + 1], w);
+			out[2 * j + 1] += resampler_tap(&buf[1][i], rs->filter[p], rs->filter[p + 1], w);
+		}
+
+		memcpy(rs->history[0], &buf[0][need], sizeof(rs->history[0]));
+		memcpy(rs->history[1], &buf[1][need], sizeof(rs->history[1]));
+		rs->frac = end & 0xffffffff;
+		out += 2 * n;
+		frames -= n;
+	}
+}
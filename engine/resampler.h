@@ -0,0 +1,31 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+
+/* Polyphase windowed-sinc resampler, converts the output of a sampler
+ * from the wav samplerate to the device samplerate. The filter has
+ * RESAMPLER_TAPS taps, its coefficients are tabulated for
+ * RESAMPLER_PHASES fractional positions and linearly interpolated in
+ * between. The sampler state machine (trig, loop, stop) keeps running at
+ * the wav rate, only its output is filtered. */
+
+#define RESAMPLER_TAPS   16 /* a multiple of 4 */
+#define RESAMPLER_PHASES 32 /* a power of two */
+#define RESAMPLER_BLOCK  512 /* source frames filtered at once */
+
+struct resampler {
+	unsigned int src_rate, dst_rate; /* the filter is built for */
+	uint64_t step; /* source frames per output frame, 32.32 fixed point */
+	uint64_t frac; /* position past the oldest history frame, 0.32 */
+	unsigned int tail; /* history frames to flush once the sampler stopped */
+	/* last source frames, one array per channel */
+	float history[2][RESAMPLER_TAPS];
+	float filter[RESAMPLER_PHASES + 1][RESAMPLER_TAPS];
+};
+
+/* Mix frames of interleaved stereo at rate into out, added to what is
+ * already there, like sampler_render. */
+void resampler_render(struct resampler *rs, struct sampler *sampler, float *out, size_t frames, unsigned int rate);
+
+#endif
@@ -1,119 +1,137 @@
 #ifndef RING_BUFFER_H
 #define RING_BUFFER_H
 
+#include <stdatomic.h>
+
+/* Lock-free ring buffer for one producer thread and one consumer thread.
+ * head and tail count elements since the start and are only masked when
+ * indexing, nmem must be a power of two. Each index is written by a
+ * single side and published with release ordering once a whole batch is
+ * written or read, the other side loads it with acquire ordering.
+ * Producer side: free_count, full, write_size, write_addr, write_done.
+ * Consumer side: fill_count, empty, read_size, read_addr, read_done.
+ * A mirrored ring has its memory mapped twice back to back, reads and
+ * writes are then contiguous whatever their position, up to nmem. */
+
+#define RING_BUFFER_CACHE_LINE 64
+
 struct ring_buffer {
 	void *base;
 	size_t nmem;
 	size_t size;
-	volatile size_t head;
-	volatile size_t tail;
+	size_t mask;
+	int mirrored;
+	/* keep each index on its own cache line, away from the other side */
+	_Alignas(RING_BUFFER_CACHE_LINE) atomic_size_t head; /* written by the producer */
+	_Alignas(RING_BUFFER_CACHE_LINE) atomic_size_t tail; /* written by the consumer */
 };
 
-inline static struct ring_buffer
-ring_buffer_init(void *base, size_t nmemb, size_t size)
+inline static void
+ring_buffer_init(struct ring_buffer *rbuf, void *base, size_t nmemb, size_t size)
 {
-	struct ring_buffer rbuf = {
-		.base = base,
-		.nmem = nmemb,
-		.size = size,
-	};
-	return rbuf;
+	if (nmemb == 0 || (nmemb & (nmemb - 1)))
+		die("ring_buffer: %zu is not a power of two\n", nmemb);
+
+	rbuf->base = base;
+	rbuf->nmem = nmemb;
+	rbuf->size = size;
+	rbuf->mask = nmemb - 1;
+	rbuf->mirrored = 0;
+	atomic_init(&rbuf->head, 0);
+	atomic_init(&rbuf->tail, 0);
+}
+
+/* base must be mapped twice, see xvmirror */
+inline static void
+ring_buffer_init_mirrored(struct ring_buffer *rbuf, void *base, size_t nmemb, size_t size)
+{
+	ring_buffer_init(rbuf, base, nmemb, size);
+	rbuf->mirrored = 1;
 }
 
 inline static size_t
 ring_buffer_fill_count(struct ring_buffer *rbuf)
 {
-	size_t n = rbuf->nmem;
-	size_t h = rbuf->head;
-	size_t t = rbuf->tail;
+	size_t h = atomic_load_explicit(&rbuf->head, memory_order_acquire);
+	size_t t = atomic_load_explicit(&rbuf->tail, memory_order_acquire);
 
-	return (2 * n + h - t) % (2 * n);
+	return h - t;
 }
 
 inline static size_t
 ring_buffer_free_count(struct ring_buffer *rbuf)
 {
-	size_t n = rbuf->nmem;
-
-	return n - ring_buffer_fill_count(rbuf);
+	return rbuf->nmem - ring_buffer_fill_count(rbuf);
 }
 
 inline static int
 ring_buffer_full(struct ring_buffer *rbuf)
 {
-	size_t n = rbuf->nmem;
-	size_t f = ring_buffer_fill_count(rbuf);
-
-	return f == n;
+	return ring_buffer_fill_count(rbuf) == rbuf->nmem;
 }
 
 inline static int
 ring_buffer_empty(struct ring_buffer *rbuf)
 {
-	size_t h = rbuf->head;
-	size_t t = rbuf->tail;
-
-	return h == t;
+	return ring_buffer_fill_count(rbuf) == 0;
 }
 
 inline static void *
 ring_buffer_read_addr(struct ring_buffer *rbuf)
 {
-	size_t n = rbuf->nmem;
-	size_t t = rbuf->tail;
-	size_t i = t % n;
+	size_t t = atomic_load_explicit(&rbuf->tail, memory_order_relaxed);
 
-	return rbuf->base + i * rbuf->size;
+	return rbuf->base + (t & rbuf->mask) * rbuf->size;
 }
 
 inline static void *
 ring_buffer_write_addr(struct ring_buffer *rbuf)
 {
-	size_t n = rbuf->nmem;
-	size_t h = rbuf->head;
-	size_t i = h % n;
+	size_t h = atomic_load_explicit(&rbuf->head, memory_order_relaxed);
 
-	return rbuf->base + i * rbuf->size;
+	return rbuf->base + (h & rbuf->mask) * rbuf->size;
 }
 
 inline static size_t
 ring_buffer_read_size(struct ring_buffer *rbuf)
 {
-	size_t n = rbuf->nmem;
-	size_t t = rbuf->tail;
-	size_t a = n - (t % n);
+	size_t t = atomic_load_explicit(&rbuf->tail, memory_order_relaxed);
+	size_t a = rbuf->nmem - (t & rbuf->mask);
 	size_t b = ring_buffer_fill_count(rbuf);
 
+	if (rbuf->mirrored)
+		return b;
 	return MIN(a, b);
 }
 
 inline static size_t
 ring_buffer_write_size(struct ring_buffer *rbuf)
 {
-	size_t n = rbuf->nmem;
-	size_t h = rbuf->head;
-	size_t a = n - (h % n);
+	size_t h = atomic_load_explicit(&rbuf->head, memory_order_relaxed);
+	size_t a = rbuf->nmem - (h & rbuf->mask);
 	size_t b = ring_buffer_free_count(rbuf);
 
+	if (rbuf->mirrored)
+		return b;
 	return MIN(a, b);
 }
 
 inline static void
 ring_buffer_read_done(struct ring_buffer *rbuf, size_t nmemb)
 {
-	size_t n = rbuf->nmem;
-	size_t t = rbuf->tail;
+	size_t t = atomic_load_explicit(&rbuf->tail, memory_order_relaxed);
 
-	rbuf->tail = (t + nmemb) % (2 * n);
+	/* the elements are consumed, the producer may overwrite them */
+	atomic_store_explicit(&rbuf->tail, t + nmemb, memory_order_release);
 }
 
 inline static void
 ring_buffer_write_done(struct ring_buffer *rbuf, size_t nmemb)
 {
-	size_t n = rbuf->nmem;
-	size_t h = rbuf->head;
+	size_t h = atomic_load_explicit(&rbuf->head, memory_order_relaxed);
 
-	rbuf->head = (h + nmemb) % (2 * n);
+	/* the elements are written, the consumer may read them */
+	atomic_store_explicit(&rbuf->head, h + nmemb, memory_order_release);
 }
 
 #endif
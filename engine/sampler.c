@@ -18,9 +18,28 @@ sampler_init(struct sampler *sampler, struct wav *wav)
 	sampler->vol = 1;
 }
 
+static int16_t
+sampler_fetch(struct wav *wav, size_t offset)
+{
+	int16_t *samples = (int16_t *) wav->audio_data;
+
+	/* the playhead goes one sample past the end before looping */
+	if (offset >= wav->extras.nb_samples)
+		return 0;
+	if (wav->stream)
+		return wav_stream_sample(wav->stream, offset);
+	return samples[offset];
+}
+
+void
+sampler_prefetch(struct sampler *sampler)
+{
+	if (sampler->wav->stream)
+		wav_stream_fill(sampler->wav->stream);
+}
+
 float step_sampler(struct sampler *sampler)
 {
-	int16_t *samples = (int16_t *) sampler->wav->audio_data;
 	float vol = sampler->vol;
 	int trig_on = sampler->trig_on;
 	size_t offset = sampler->pb_head;
@@ -37,7 +56,7 @@ float step_sampler(struct sampler *sampler)
 			sampler->trig_on = 0;
 			sampler->pb_head++;
 			offset = sampler->pb_head;
-			x = vol * (float) (samples[offset] / (float) INT16_MAX);
+			x = vol * (float) (sampler_fetch(sampler->wav, offset) / (float) INT16_MAX);
 			return x;
 		} else {
 			return 0;
@@ -58,7 +77,7 @@ float step_sampler(struct sampler *sampler)
 		} else {
 			sampler->pb_head ++;
 			offset = sampler->pb_head;
-			x = vol * (float) (samples[offset] / (float) INT16_MAX);
+			x = vol * (float) (sampler_fetch(sampler->wav, offset) / (float) INT16_MAX);
 			return x;
 		}
 
@@ -66,3 +85,84 @@ float step_sampler(struct sampler *sampler)
 	}
 	return 0;
 }
+
+/* out[i] += gain * in[i], kept simple for the compiler to vectorize */
+static void
+mix_block(float *restrict out, const int16_t *restrict in, size_t len, float gain)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		out[i] += gain * in[i];
+}
+
+/* mix len samples of wav read from offset into out */
+static void
+sampler_mix(struct wav *wav, float *out, size_t offset, size_t len, float gain)
+{
+	const int16_t *in;
+	size_t n;
+
+	if (offset >= wav->extras.nb_samples)
+		return;
+	len = MIN(len, wav->extras.nb_samples - offset);
+
+	if (!wav->stream) {
+		mix_block(out, (int16_t *) wav->audio_data + offset, len, gain);
+		return;
+	}
+
+	while (len > 0) {
+		n = len;
+		in = wav_stream_span(wav->stream, offset, &n);
+		if (!in)
+			return;
+		mix_block(out, in, n, gain);
+		out += n;
+		offset += n;
+		len -= n;
+	}
+}
+
+void
+sampler_render(struct sampler *sampler, float *out, size_t frames)
+{
+	struct wav *wav = sampler->wav;
+	size_t end = wav->extras.nb_samples;
+	size_t count = frames * 2; /* interleaved left and right */
+	float gain = sampler->vol / INT16_MAX;
+	size_t i = 0, len;
+
+	if (sampler->loop_start >= sampler->pb_end)
+		sampler->loop_on = 0;
+
+	while (i < count) {
+		if (sampler->state == STOP) {
+			if (!sampler->trig_on)
+				return;
+			/* like step_sampler, the trig sample is played unconditionally */
+			sampler->state = PLAY;
+			sampler->trig_on = 0;
+			sampler->pb_head++;
+			sampler_mix(wav, out + i, sampler->pb_head, 1, gain);
+			i++;
+			continue;
+		}
+
+		if (sampler->pb_head >= end) {
+			if (!sampler->loop_on || sampler->loop_start >= end) {
+				sampler->state = STOP;
+				sampler->pb_head = sampler->pb_start;
+				i++; /* stopping takes a silent sample */
+				continue;
+			}
+			sampler->pb_head = sampler->loop_start;
+		}
+
+		/* play up to the end of the wav in one go */
+		len = MIN(count - i, end - sampler->pb_head);
+		sampler_mix(wav, out + i, sampler->pb_head + 1, len, gain);
+		sampler->pb_head += len;
+		i += len;
+	}
+}
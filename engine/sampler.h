@@ -27,5 +27,10 @@ struct sampler {
 void sampler_init(struct sampler *sampler, struct wav *wav);
 
 float step_sampler(struct sampler *sampler);
+/* Mix frames of interleaved stereo into out, added to what is already
+ * there, the same as calling step_sampler twice per frame. */
+void sampler_render(struct sampler *sampler, float *out, size_t frames);
+/* decode ahead streamed samples, outside of the mixing loop */
+void sampler_prefetch(struct sampler *sampler);
 
 #endif
@@ -0,0 +1,145 @@
+#include <limits.h>
+
+#include "engine.h"
+#include "stb_vorbis.c"
+
+size_t
+wav_stream_probe(void *data, size_t size, struct memory_zone *scratch)
+{
+	struct memory_zone mem_state = *scratch; /* save memory state */
+	stb_vorbis_alloc alloc;
+	stb_vorbis_info info;
+	stb_vorbis *vorbis;
+	size_t need = 0;
+	int err;
+
+	alloc.alloc_buffer_length_in_bytes = MIN(scratch->size - scratch->used, INT_MAX);
+	alloc.alloc_buffer = mempush(scratch, alloc.alloc_buffer_length_in_bytes);
+
+	vorbis = stb_vorbis_open_memory(data, size, &err, &alloc);
+	if (vorbis) {
+		info = stb_vorbis_get_info(vorbis);
+		if (info.channels == 1 || info.channels == 2)
+			need = info.setup_memory_required + info.setup_temp_memory_required
+				+ info.temp_memory_required;
+		stb_vorbis_close(vorbis);
+	}
+
+	/* restore memory zone */
+	*scratch = mem_state;
+
+	return need;
+}
+
+int
+wav_stream_open(struct wav *wav, struct wav_stream *stream, void *data, size_t size, void *mem, size_t memsize)
+{
+	stb_vorbis_alloc alloc;
+	stb_vorbis_info info;
+	stb_vorbis *vorbis;
+	int err;
+
+	alloc.alloc_buffer = mem;
+	alloc.alloc_buffer_length_in_bytes = memsize;
+
+	vorbis = stb_vorbis_open_memory(data, size, &err, &alloc);
+	if (!vorbis)
+		return -1;
+
+	info = stb_vorbis_get_info(vorbis);
+	stream->vorbis = vorbis;
+	stream->channels = info.channels;
+	stream->begin = 0;
+	stream->end = 0;
+	stream->read = 0;
+
+	wav->stream = stream;
+	wav->audio_data = NULL;
+	wav->header.channels = info.channels;
+	wav->header.samplerate = info.sample_rate;
+	wav->extras.samplesize = sizeof(int16_t);
+	wav->extras.nb_frames = stb_vorbis_stream_length_in_samples(vorbis);
+	wav->extras.nb_samples = wav->extras.nb_frames * info.channels;
+	wav->extras.frame_size = sizeof(int16_t) * info.channels;
+
+	return 0;
+}
+
+/* decode into the free space of the ring, up to its end, return the
+ * number of decoded samples */
+static size_t
+wav_stream_decode(struct wav_stream *stream)
+{
+	size_t pos = stream->end % WAV_STREAM_SIZE;
+	size_t len;
+	int n;
+
+	len = WAV_STREAM_SIZE - (stream->end - stream->read);
+	len = MIN(len, WAV_STREAM_SIZE - pos);
+	len -= len % stream->channels;
+	if (len == 0)
+		return 0;
+
+	n = stb_vorbis_get_samples_short_interleaved(stream->vorbis, stream->channels,
+						     &stream->ring[pos], len);
+	if (n <= 0)
+		return 0;
+
+	stream->end += n * stream->channels;
+	if (stream->end - stream->begin > WAV_STREAM_SIZE)
+		stream->begin = stream->end - WAV_STREAM_SIZE;
+
+	return n * stream->channels;
+}
+
+static void
+wav_stream_seek(struct wav_stream *stream, size_t offset)
+{
+	size_t frame = offset / stream->channels;
+
+	stb_vorbis_seek(stream->vorbis, frame);
+	stream->begin = frame * stream->channels;
+	stream->end = stream->begin;
+	stream->read = stream->begin;
+}
+
+const int16_t *
+wav_stream_span(struct wav_stream *stream, size_t offset, size_t *len)
+{
+	size_t pos = offset % WAV_STREAM_SIZE;
+
+	/* jumps backward or far ahead, typically loops, need a seek */
+	if (offset < stream->begin || offset > stream->end + WAV_STREAM_SIZE)
+		wav_stream_seek(stream, offset);
+
+	while (offset >= stream->end) {
+		stream->read = stream->end;
+		if (!wav_stream_decode(stream))
+			return NULL; /* end of stream */
+	}
+
+	/* stop at the last decoded sample or at the end of the ring */
+	*len = MIN(*len, stream->end - offset);
+	*len = MIN(*len, WAV_STREAM_SIZE - pos);
+	stream->read = offset + *len - 1;
+
+	return &stream->ring[pos];
+}
+
+int16_t
+wav_stream_sample(struct wav_stream *stream, size_t offset)
+{
+	const int16_t *s;
+	size_t len = 1;
+
+	s = wav_stream_span(stream, offset, &len);
+
+	return s ? *s : 0;
+}
+
+void
+wav_stream_fill(struct wav_stream *stream)
+{
+	while (wav_stream_decode(stream))
+		;
+}
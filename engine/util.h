@@ -13,6 +13,8 @@ void die(const char *fmt, ...);
 #define SZ_4M		0x00400000
 #define SZ_8M		0x00800000
 #define SZ_16M		0x01000000
+#define SZ_32M		0x02000000
+#define SZ_64M		0x04000000
 #define SZ_256M		0x10000000
 
 struct memory_zone {
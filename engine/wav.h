@@ -29,6 +29,34 @@ struct wav{
 	struct header header;
 	struct extras extras;
 	void *audio_data;
+	struct wav_stream *stream; /* audio_data is NULL when streamed */
 };
 
+/* Ogg vorbis stream: the encoded data stays in memory and is decoded a
+ * few thousand samples ahead of the last read sample, into a ring.
+ * The decoder and the ring belong to the wav, not to a voice: a streamed
+ * wav is only to be played by one voice at a time, two would keep seeking
+ * over each other. */
+#define WAV_STREAM_SIZE 16384 /* in samples, a multiple of the channels */
+
+struct wav_stream {
+	void *vorbis; /* stb_vorbis decoder */
+	unsigned int channels;
+	size_t begin, end; /* interleaved samples held in the ring */
+	size_t read; /* last sample read */
+	int16_t ring[WAV_STREAM_SIZE];
+};
+
+/* memory needed by the decoder for this data, 0 if it cannot be decoded,
+ * scratch is only used temporarily */
+size_t wav_stream_probe(void *data, size_t size, struct memory_zone *scratch);
+/* open the stream in wav, mem must be as big as reported by the probe */
+int wav_stream_open(struct wav *wav, struct wav_stream *stream, void *data, size_t size, void *mem, size_t memsize);
+int16_t wav_stream_sample(struct wav_stream *stream, size_t offset);
+/* decoded samples from offset, contiguous in the ring: len is clamped to
+ * what is available, NULL past the end of the stream */
+const int16_t *wav_stream_span(struct wav_stream *stream, size_t offset, size_t *len);
+/* decode ahead until the ring is full */
+void wav_stream_fill(struct wav_stream *stream);
+
 #endif
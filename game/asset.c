@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "engine/engine.h"
 #include "game.h"
@@ -14,13 +15,46 @@ struct asset_file {
 	time_t time;
 	ssize_t size;
 	char *data;
+	int mapped; /* data is mapped, release it with res_unmap_file */
 };
 
-struct obj_info {
-	unsigned int vert_count;
-	unsigned int texc_count;
-	unsigned int norm_count;
-	unsigned int face_count;
+/* Baked mesh, stored next to the obj file as "<file>.bin": the header is
+ * followed by vertex_count struct mesh_vertex and index_count 32 bits
+ * indices, ready to be uploaded as is. The blob is only used for the obj
+ * file of the same size and time it was baked from. */
+#define MESH_BLOB_MAGIC   0x48534d42 /* "BMSH" */
+#define MESH_BLOB_VERSION 2
+
+struct mesh_blob {
+	uint32_t magic;
+	uint32_t version;
+	int64_t obj_time;
+	int64_t obj_size;
+	uint32_t vertex_size;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	struct bounding_volume bounding;
+};
+
+struct mesh_data {
+	struct mesh_vertex *vertices;
+	unsigned int *indices;
+	size_t vertex_count;
+	size_t index_count;
+	struct bounding_volume bounding;
+	time_t time; /* obj file time */
+	int64_t size; /* obj file size */
+};
+
+/* mesh parsed from an obj file, normals and texcoords are NULL when the
+ * file has none, indices hold 3 vertices per triangle */
+struct obj_data {
+	float *positions;
+	float *normals;
+	float *texcoords;
+	unsigned int *indices;
+	size_t vertex_count;
+	size_t index_count;
 };
 
 static void load_debug_line(struct mesh *m);
@@ -158,21 +192,88 @@ static int res_file_changed(struct game_asset *game_asset, union res_file *res,
 
 static void res_reload_shader(struct game_asset *game_asset, enum asset_key key);
 static void res_reload_mesh_obj(struct game_asset *game_asset, enum asset_key key);
+static int res_load_mesh(struct game_asset *game_asset, struct memory_zone *zone, enum asset_key key, struct mesh_data *out);
+static void res_upload_mesh(struct game_asset *game_asset, enum asset_key key, struct mesh_data *data);
 static void res_reload_wav(struct game_asset *game_asset, enum asset_key key);
-static void res_reload_ogg(struct game_asset *game_asset, enum asset_key key);
+static void res_reload_ogg(struct game_asset *game_asset, struct memory_zone *zone, enum asset_key key);
 
 static void load_wav(struct wav *wav, char *obj);
-static struct obj_info read_obj_info(struct asset_file *file);
-static void load_obj(struct memory_zone *zone, struct asset_file *file, struct obj_info info,
-	 size_t count, float *out_vert, float *out_norm, float *out_texc);
+static void load_obj(struct memory_zone *zone, struct asset_file *file, struct obj_data *out);
+
+enum asset_type {
+	ASSET_SHADER,
+	ASSET_PROCEDURAL,
+	ASSET_MESH,
+	ASSET_WAV,
+	ASSET_OGG,
+	ASSET_NONE,
+};
+
+static enum asset_type
+asset_type(enum asset_key key)
+{
+	switch (key) {
+	case SHADER_WALL:
+	case SHADER_SOLID:
+	case SHADER_SCREEN:
+	case SHADER_TEXT:
+		return ASSET_SHADER;
+	case DEBUG_MESH_CYLINDER:
+	case DEBUG_MESH_CROSS:
+		return ASSET_PROCEDURAL;
+	case MESH_WALL:
+	case MESH_ROCK:
+	case MESH_ROOM:
+	case MESH_SCREEN:
+	case MESH_CAP:
+	case MESH_PLAYER:
+	case MESH_MENU_QUIT:
+	case MESH_MENU_START:
+		return ASSET_MESH;
+	case WAV_THEME:
+	case WAV_CASEY:
+	case WAV_WIND:
+		return ASSET_OGG;
+	case WAV_MENU:
+	case WAV_WOOSH_00:
+	case WAV_WOOSH_01:
+	case WAV_WOOSH_02:
+	case WAV_WOOSH_03:
+	case WAV_CRASH_00:
+	case WAV_CRASH_01:
+	case WAV_CRASH_02:
+	case WAV_CRASH_03:
+		return ASSET_WAV;
+	default:
+		return ASSET_NONE;
+	}
+}
+
+/* memzone and samples are shared with the workers during the preload */
+static void *
+asset_mempush(struct game_asset *game_asset, struct memory_zone *zone, size_t size)
+{
+	void *addr;
+
+	if (game_asset->jobs)
+		job_lock(game_asset->jobs);
+	addr = mempush(zone, size);
+	if (game_asset->jobs)
+		job_unlock(game_asset->jobs);
+
+	return addr;
+}
 
+/* not loaded until the loader says so, a reload keeps watching the files */
 static struct res_data
-asset_push_res_data(struct game_asset *game_asset, size_t size)
+asset_push_res_data(struct game_asset *game_asset, enum asset_key key, size_t size)
 {
-	struct res_data res;
+	struct res_data res = { 0 };
 
+	res.watch = game_asset->assets[key].watch;
+	res.since = game_asset->assets[key].since;
 	res.size = size;
-	res.base = mempush(game_asset->memzone, res.size);
+	res.base = asset_mempush(game_asset, game_asset->memzone, res.size);
 
 	return res;
 }
@@ -195,50 +296,26 @@ asset_reload(struct game_asset *game_asset, enum asset_key key)
 {
 	struct res_data *res = &game_asset->assets[key];
 
-	switch (key) {
-	case SHADER_WALL:
-	case SHADER_SOLID:
-	case SHADER_SCREEN:
-	case SHADER_TEXT:
-		*res = asset_push_res_data(game_asset, sizeof(struct shader));
+	switch (asset_type(key)) {
+	case ASSET_SHADER:
+		*res = asset_push_res_data(game_asset, key, sizeof(struct shader));
 		res_reload_shader(game_asset, key);
 		break;
-	case DEBUG_MESH_CYLINDER:
-		*res = asset_push_res_data(game_asset, sizeof(struct mesh));
-		mesh_load_cylinder(res->base, 2, 1, 16);
+	case ASSET_PROCEDURAL:
+		*res = asset_push_res_data(game_asset, key, sizeof(struct mesh));
+		if (key == DEBUG_MESH_CYLINDER)
+			mesh_load_cylinder(res->base, 2, 1, 16);
+		else
+			mesh_load_cross(res->base, 1.0);
 		asset_state(game_asset, key, STATE_LOADED);
 		break;
-	case DEBUG_MESH_CROSS:
-		*res = asset_push_res_data(game_asset, sizeof(struct mesh));
-		mesh_load_cross(res->base, 1.0);
-		asset_state(game_asset, key, STATE_LOADED);
-		break;
-	case MESH_WALL:
-	case MESH_ROCK:
-	case MESH_ROOM:
-	case MESH_SCREEN:
-	case MESH_CAP:
-	case MESH_PLAYER:
-	case MESH_MENU_QUIT:
-	case MESH_MENU_START:
+	case ASSET_MESH:
 		res_reload_mesh_obj(game_asset, key);
 		break;
-	case WAV_THEME:
-	case WAV_CASEY:
-	case WAV_WIND:
-		res_reload_ogg(game_asset, key);
+	case ASSET_OGG:
+		res_reload_ogg(game_asset, game_asset->samples, key);
 		break;
-	case WAV_MENU:
-		res_reload_wav(game_asset, key);
-		break;
-	case WAV_WOOSH_00:
-	case WAV_WOOSH_01:
-	case WAV_WOOSH_02:
-	case WAV_WOOSH_03:
-	case WAV_CRASH_00:
-	case WAV_CRASH_01:
-	case WAV_CRASH_02:
-	case WAV_CRASH_03:
+	case ASSET_WAV:
 		res_reload_wav(game_asset, key);
 		break;
 	default:
@@ -258,7 +335,7 @@ res_load_file(struct game_asset *game_asset, struct memory_zone *zone, const cha
 	f.size = game_asset->file_io->size(filename);
 
 	if (f.size > 0)
-		f.data = mempush(zone, f.size + 1);
+		f.data = asset_mempush(game_asset, zone, f.size + 1);
 	if (f.data) {
 		game_asset->file_io->read(filename, f.data, f.size);
 		f.data[f.size] = '\0';
@@ -305,47 +382,242 @@ out:
 	game_asset->tmpzone = mem_state;
 }
 
+static struct asset_file
+res_map_file(struct game_asset *game_asset, struct memory_zone *zone, const char *filename)
+{
+	struct asset_file f = { 0 };
+	size_t size;
+
+	if (game_asset->file_io->map)
+		f.data = game_asset->file_io->map(filename, &size);
+	if (!f.data)
+		return res_load_file(game_asset, zone, filename);
+
+	f.name = filename;
+	f.time = game_asset->file_io->time(filename);
+	f.size = size;
+	f.mapped = 1;
+
+	return f;
+}
+
 static void
-res_reload_mesh_obj(struct game_asset *game_asset, enum asset_key key)
+res_unmap_file(struct game_asset *game_asset, struct asset_file *file)
+{
+	if (file->mapped)
+		game_asset->file_io->unmap(file->data, file->size);
+	file->data = NULL;
+	file->mapped = 0;
+}
+
+static void
+res_blob_name(char *buf, size_t len, const char *file)
+{
+	snprintf(buf, len, "%s.bin", file);
+}
+
+static double
+elapsed_ms(double start)
+{
+	return (job_time() - start) * 1000.0;
+}
+
+/* parse an obj file, everything is allocated in zone */
+static int
+res_parse_mesh_obj(struct game_asset *game_asset, struct memory_zone *zone, const char *filename, struct mesh_data *out)
 {
-	struct memory_zone mem_state = game_asset->tmpzone; /* save memory state */
-	union res_file *res = &resfiles[key];
-	struct mesh *mesh;
 	struct asset_file file;
-	struct obj_info info;
-	float *positions;
-	float *normals;
-	float *texcoords;
-	size_t fcount;
+	struct obj_data obj;
 
-	game_asset->assets[key] = asset_push_res_data(game_asset, sizeof(struct mesh));
-	file = res_load_file(game_asset, &game_asset->tmpzone, res->file);
-	if (file.data) {
-		info = read_obj_info(&file);
+	file = res_load_file(game_asset, zone, filename);
+	if (!file.data)
+		return -1;
 
-		fcount = info.face_count;
-		/* keep positions outside of scrap/tmp zone */
-		positions = mempush(game_asset->memzone, fcount * 3 * 3 * sizeof(float));
-		normals   = mempush(&game_asset->tmpzone, fcount * 3 * 3 * sizeof(float));
-		texcoords = NULL;
-		if (info.texc_count > 0)
-			texcoords = mempush(&game_asset->tmpzone, fcount * 3 * 2 * sizeof(float));
+	load_obj(zone, &file, &obj);
 
-		load_obj(&game_asset->tmpzone, &file, info, fcount, positions, normals, texcoords);
+	out->indices = obj.indices;
+	out->index_count = obj.index_count;
+	out->vertex_count = obj.vertex_count;
+	out->vertices = mempush(zone, out->vertex_count * sizeof(struct mesh_vertex));
+	mesh_pack(out->vertices, out->vertex_count, obj.positions, obj.normals, obj.texcoords);
+	out->bounding = mesh_bounding(out->vertex_count, out->vertices);
 
-		mesh = game_asset->assets[key].base;
-		/* for now mesh are triangulates: no index list */
-		mesh_load(mesh, fcount * 3, GL_TRIANGLES, positions, normals, texcoords);
-		mesh->positions = positions;
+	return 0;
+}
 
-		asset_since(game_asset, key, file.time);
-		asset_state(game_asset, key, STATE_LOADED);
+/* point the mesh data into a blob, fail if the blob is not valid or was
+ * not baked from the obj file of out->time and out->size */
+static int
+res_read_mesh_blob(struct asset_file *blob, struct mesh_data *out)
+{
+	struct mesh_blob *hdr = (struct mesh_blob *)blob->data;
+	size_t size, i;
+
+	if (!blob->data || blob->size < (ssize_t)sizeof(*hdr))
+		return -1;
+	if (hdr->magic != MESH_BLOB_MAGIC || hdr->version != MESH_BLOB_VERSION)
+		return -1;
+	if (hdr->obj_time != out->time || hdr->obj_size != out->size)
+		return -1;
+	if (hdr->vertex_size != sizeof(struct mesh_vertex))
+		return -1;
+
+	size = sizeof(*hdr);
+	size += hdr->vertex_count * sizeof(struct mesh_vertex);
+	size += hdr->index_count * sizeof(uint32_t);
+	if (blob->size != (ssize_t)size)
+		return -1;
+
+	out->vertices = (void *)(hdr + 1);
+	out->indices = (void *)(out->vertices + hdr->vertex_count);
+	out->vertex_count = hdr->vertex_count;
+	out->index_count = hdr->index_count;
+	out->bounding = hdr->bounding;
+
+	/* a stale or corrupt blob could make the draws read out of bounds */
+	for (i = 0; i < out->index_count; i++)
+		if (out->indices[i] >= out->vertex_count)
+			return -1;
+
+	return 0;
+}
+
+static int
+res_write_mesh_blob(struct game_asset *game_asset, struct memory_zone *zone, const char *filename, struct mesh_data *data)
+{
+	struct memory_zone mem_state = *zone; /* save memory state */
+	struct mesh_blob *hdr;
+	size_t vsize, isize;
+	char *buf;
+	int64_t ret = -1;
+
+	vsize = data->vertex_count * sizeof(struct mesh_vertex);
+	isize = data->index_count * sizeof(uint32_t);
+
+	buf = mempush(zone, sizeof(*hdr) + vsize + isize);
+	if (buf) {
+		hdr = (struct mesh_blob *)buf;
+		hdr->magic = MESH_BLOB_MAGIC;
+		hdr->version = MESH_BLOB_VERSION;
+		hdr->obj_time = data->time;
+		hdr->obj_size = data->size;
+		hdr->vertex_size = sizeof(struct mesh_vertex);
+		hdr->vertex_count = data->vertex_count;
+		hdr->index_count = data->index_count;
+		hdr->bounding = data->bounding;
+		memcpy(buf + sizeof(*hdr), data->vertices, vsize);
+		memcpy(buf + sizeof(*hdr) + vsize, data->indices, isize);
+		ret = game_asset->file_io->write(filename, buf, sizeof(*hdr) + vsize + isize);
 	}
 
+	/* restore memory zone */
+	*zone = mem_state;
+
+	return (ret < 0) ? -1 : 0;
+}
+
+/* CPU side of the mesh loading, safe to run on a worker: zone is used for
+ * temporary data, the mesh data is left in the memzone for res_upload_mesh */
+static int
+res_load_mesh(struct game_asset *game_asset, struct memory_zone *zone, enum asset_key key, struct mesh_data *out)
+{
+	struct memory_zone mem_state = *zone; /* save memory state */
+	union res_file *res = &resfiles[key];
+	struct asset_file blob;
+	struct mesh_data data;
+	size_t vsize, isize;
+	char blobname[256];
+	const char *from;
+	double start;
+	int ret = -1;
+
+	start = job_time();
+	game_asset->assets[key] = asset_push_res_data(game_asset, key, sizeof(struct mesh));
+	/* before the parse, a change while parsing bakes a stale blob */
+	out->time = data.time = game_asset->file_io->time(res->file);
+	data.size = game_asset->file_io->size(res->file);
+
+	/* use the baked mesh unless the obj file changed */
+	res_blob_name(blobname, sizeof(blobname), res->file);
+	blob = res_map_file(game_asset, zone, blobname);
+	if (res_read_mesh_blob(&blob, &data) == 0) {
+		from = "blob";
+	} else if (res_parse_mesh_obj(game_asset, zone, res->file, &data) == 0) {
+		from = "obj";
+		/* bake it for the next run */
+		if (res_write_mesh_blob(game_asset, zone, blobname, &data))
+			fprintf(stderr, "%s: fail to bake mesh\n", blobname);
+	} else {
+		goto out;
+	}
+
+	vsize = data.vertex_count * sizeof(struct mesh_vertex);
+	isize = data.index_count * sizeof(unsigned int);
+	out->vertices = asset_mempush(game_asset, game_asset->memzone, vsize);
+	out->indices = asset_mempush(game_asset, game_asset->memzone, isize);
+	memcpy(out->vertices, data.vertices, vsize);
+	memcpy(out->indices, data.indices, isize);
+	out->vertex_count = data.vertex_count;
+	out->index_count = data.index_count;
+	out->bounding = data.bounding;
+
+	printf("%s: %zu vertices, %zu indices, from %s in %.3f ms\n",
+	       res->file, data.vertex_count, data.index_count,
+	       from, elapsed_ms(start));
+	ret = 0;
+out:
+	res_unmap_file(game_asset, &blob);
+	/* restore memory zone */
+	*zone = mem_state;
+
+	return ret;
+}
+
+/* GL side of the mesh loading, main thread only */
+static void
+res_upload_mesh(struct game_asset *game_asset, enum asset_key key, struct mesh_data *data)
+{
+	struct memory_zone mem_state = game_asset->tmpzone; /* save memory state */
+	struct mesh *mesh = game_asset->assets[key].base;
+	uint16_t *indices16;
+	size_t i;
+
+	mesh_load_packed(mesh, data->vertex_count, GL_TRIANGLES, data->vertices);
+	mesh->bounding = data->bounding;
+	/* built on the first ray cast, see game_get_mesh_bvh */
+	memset(&mesh->bvh, 0, sizeof(mesh->bvh));
+
+	/* keep positions and indices outside of scrap/tmp zone */
+	mesh->indices = data->indices;
+	mesh->positions = asset_mempush(game_asset, game_asset->memzone, data->vertex_count * 3 * sizeof(float));
+	for (i = 0; i < data->vertex_count; i++)
+		memcpy(&mesh->positions[i * 3], data->vertices[i].position, 3 * sizeof(float));
+
+	if (data->vertex_count <= UINT16_MAX + 1) {
+		indices16 = mempush(&game_asset->tmpzone, data->index_count * sizeof(uint16_t));
+		for (i = 0; i < data->index_count; i++)
+			indices16[i] = data->indices[i];
+		mesh_index(mesh, data->index_count, GL_UNSIGNED_SHORT, indices16);
+	} else {
+		mesh_index(mesh, data->index_count, GL_UNSIGNED_INT, data->indices);
+	}
+
+	asset_since(game_asset, key, data->time);
+	asset_state(game_asset, key, STATE_LOADED);
+
 	/* restore memory zone */
 	game_asset->tmpzone = mem_state;
 }
 
+static void
+res_reload_mesh_obj(struct game_asset *game_asset, enum asset_key key)
+{
+	struct mesh_data data;
+
+	if (res_load_mesh(game_asset, &game_asset->tmpzone, key, &data) == 0)
+		res_upload_mesh(game_asset, key, &data);
+}
+
 static void
 res_reload_wav(struct game_asset *game_asset, enum asset_key key)
 {
@@ -355,7 +627,7 @@ res_reload_wav(struct game_asset *game_asset, enum asset_key key)
 
 	file = res_load_file(game_asset, game_asset->samples, res->file);
 	if (file.data) {
-		game_asset->assets[key] = asset_push_res_data(game_asset, sizeof(struct wav));
+		game_asset->assets[key] = asset_push_res_data(game_asset, key, sizeof(struct wav));
 		wav = game_asset->assets[key].base;
 		load_wav(wav, file.data);
 		asset_since(game_asset, key, file.time);
@@ -364,34 +636,117 @@ res_reload_wav(struct game_asset *game_asset, enum asset_key key)
 	/* samples memory zone is not freed */
 }
 
-#include "stb_vorbis.c"
+#define STB_VORBIS_HEADER_ONLY
+#include "engine/stb_vorbis.c"
 
+#ifdef CONFIG_OGG_STREAM
+/* give back a block of a zone shared with the workers, only if it is still
+ * the last one pushed */
 static void
-res_reload_ogg(struct game_asset *game_asset, enum asset_key key)
+asset_mempop(struct game_asset *game_asset, struct memory_zone *zone, void *addr, size_t size)
 {
-	struct memory_zone mem_state = *game_asset->samples;
+	if (game_asset->jobs)
+		job_lock(game_asset->jobs);
+	if ((char *)addr + size == (char *)zone->base + zone->used)
+		zone->used -= size;
+	if (game_asset->jobs)
+		job_unlock(game_asset->jobs);
+}
+
+/* Keep the encoded file in the samples zone and decode it while playing.
+ * The mixer holds on to the wav and the stream of the first load, whose
+ * decoder runs on the audio thread: a streamed ogg is not reloaded, the
+ * change is heard on the next start. */
+static void
+res_reload_ogg(struct game_asset *game_asset, struct memory_zone *zone, enum asset_key key)
+{
+	union res_file *res = &resfiles[key];
+	struct memory_zone *samples = game_asset->samples;
+	struct wav_stream *stream;
+	struct asset_file file;
+	struct wav *wav;
+	size_t memsize, size;
+	double start;
+	void *mem;
+
+	if (game_asset->assets[key].base) {
+		printf("%s: streamed, not reloaded while playing\n", res->file);
+		asset_since(game_asset, key, game_asset->file_io->time(res->file));
+		asset_state(game_asset, key, STATE_LOADED);
+		return;
+	}
+
+	start = job_time();
+	file = res_load_file(game_asset, samples, res->file);
+	if (!file.data)
+		return;
+
+	memsize = wav_stream_probe(file.data, file.size, zone);
+	if (!memsize) {
+		fprintf(stderr, "%s: cannot stream file\n", res->file);
+		asset_mempop(game_asset, samples, file.data, file.size + 1);
+		return;
+	}
+
+	/* room to align the stream after the file */
+	size = 15 + sizeof(*stream) + memsize;
+	mem = asset_mempush(game_asset, samples, size);
+	stream = (void *)(((uintptr_t)mem + 15) & ~(uintptr_t)15);
+	game_asset->assets[key] = asset_push_res_data(game_asset, key, sizeof(struct wav));
+	wav = game_asset->assets[key].base;
+	if (wav_stream_open(wav, stream, file.data, file.size, stream + 1, memsize)) {
+		fprintf(stderr, "%s: cannot open stream\n", res->file);
+		asset_mempop(game_asset, samples, mem, size);
+		asset_mempop(game_asset, samples, file.data, file.size + 1);
+		game_asset->assets[key].base = NULL;
+		return;
+	}
+
+	printf("%s: streamed, %zu KiB resident, opened in %.3f ms\n", res->file,
+	       (file.size + sizeof(*stream) + memsize) / 1024, elapsed_ms(start));
+
+	asset_since(game_asset, key, file.time);
+	asset_state(game_asset, key, STATE_LOADED);
+}
+#else
+/* the whole file is decoded, zone only holds the encoded data */
+static void
+res_reload_ogg(struct game_asset *game_asset, struct memory_zone *zone, enum asset_key key)
+{
+	struct memory_zone mem_state = *zone;
 	struct wav *wav;
 	union res_file *res = &resfiles[key];
 	struct asset_file file;
 	int channels, samplerate, frames;
 	uint16_t *output;
+	double start;
 
-	file = res_load_file(game_asset, game_asset->samples, res->file);
+	start = job_time();
+	file = res_map_file(game_asset, zone, res->file);
 	if (file.data) {
-		frames = stb_vorbis_decode_memory(file.data, file.size, &channels, &samplerate, &output);
-		game_asset->assets[key] = asset_push_res_data(game_asset, sizeof(struct wav));
+		frames = stb_vorbis_decode_memory((unsigned char *)file.data, file.size, &channels, &samplerate, (short **)&output);
+		game_asset->assets[key] = asset_push_res_data(game_asset, key, sizeof(struct wav));
 
 		wav = game_asset->assets[key].base;
 		wav->extras.samplesize = sizeof(uint16_t);
 		wav->extras.nb_frames = frames;
 		wav->extras.nb_samples = frames * channels;
 		wav->header.channels = channels;
+		wav->header.samplerate = samplerate;
 		wav->audio_data = output;
+		wav->stream = NULL;
+		if (frames > 0) {
+			printf("%s: decoded, %zu KiB resident, in %.3f ms\n", res->file,
+			       wav->extras.nb_samples * sizeof(uint16_t) / 1024, elapsed_ms(start));
+			asset_since(game_asset, key, file.time);
+			asset_state(game_asset, key, STATE_LOADED);
+		}
 	}
+	res_unmap_file(game_asset, &file);
 	/* restore memory zone */
-	*game_asset->samples = mem_state;
+	*zone = mem_state;
 }
-
+#endif
 
 static int
 res_file_changed(struct game_asset *game_asset, union res_file *res, time_t since)
@@ -402,12 +757,17 @@ res_file_changed(struct game_asset *game_asset, union res_file *res, time_t sinc
 	if (res->file != res->vert)
 		die("fixme: res_file_changed\n");
 
+	/* only shaders have the other files */
 	ctime = game_asset->file_io->time(res->vert);
 	time = MAX(ctime, time);
-	ctime = game_asset->file_io->time(res->frag);
-	time = MAX(ctime, time);
-	ctime = game_asset->file_io->time(res->geom);
-	time = MAX(ctime, time);
+	if (res->frag) {
+		ctime = game_asset->file_io->time(res->frag);
+		time = MAX(ctime, time);
+	}
+	if (res->geom) {
+		ctime = game_asset->file_io->time(res->geom);
+		time = MAX(ctime, time);
+	}
 
 	return since < time;
 }
@@ -438,6 +798,38 @@ game_get_mesh(struct game_asset *game_asset, enum asset_key key)
 	return game_get_asset(game_asset, key);
 }
 
+/* never loads, the asset state only changes between two frame builds */
+static void *
+game_find_asset(struct game_asset *game_asset, enum asset_key key)
+{
+	if (key >= ASSET_KEY_COUNT || game_asset->assets[key].state != STATE_LOADED)
+		return NULL;
+
+	return game_asset->assets[key].base;
+}
+
+struct shader *
+game_find_shader(struct game_asset *game_asset, enum asset_key key)
+{
+	return game_find_asset(game_asset, key);
+}
+
+struct mesh *
+game_find_mesh(struct game_asset *game_asset, enum asset_key key)
+{
+	return game_find_asset(game_asset, key);
+}
+
+struct bvh *
+game_get_mesh_bvh(struct game_asset *game_asset, struct mesh *mesh)
+{
+	if (!mesh->bvh.nodes && mesh->indices)
+		bvh_build(&mesh->bvh, game_asset->memzone, mesh->positions, 3 * sizeof(float),
+			  mesh->indices, mesh->index_count);
+
+	return &mesh->bvh;
+}
+
 struct wav *
 game_get_wav(struct game_asset *game_asset, enum asset_key key)
 {
@@ -445,22 +837,64 @@ game_get_wav(struct game_asset *game_asset, enum asset_key key)
 
 	wav = game_get_asset(game_asset, key);
 	if (!wav)
-		wav = &silent_wav;
+		wav = &game_asset->silent_wav;
 
 	return wav;
 }
 
+/* register the files of a loaded asset, poll them if they cannot be
+ * watched */
+static void
+res_file_watch(struct game_asset *game_asset, enum asset_key key)
+{
+	union res_file *res = &resfiles[key];
+	struct file_io *file_io = game_asset->file_io;
+	enum asset_watch watch = WATCH_NOTIFY;
+
+	if ((res->vert && file_io->watch(res->vert) < 0) ||
+	    (res->frag && file_io->watch(res->frag) < 0) ||
+	    (res->geom && file_io->watch(res->geom) < 0))
+		watch = WATCH_POLL;
+
+	game_asset->assets[key].watch = watch;
+}
+
+static int
+res_file_uses(union res_file *res, const char *path)
+{
+	return (res->vert && strcmp(res->vert, path) == 0) ||
+	       (res->frag && strcmp(res->frag, path) == 0) ||
+	       (res->geom && strcmp(res->geom, path) == 0);
+}
+
+/* only the changed files are looked at, when none changed it costs no
+ * file system call */
 void
 game_asset_poll(struct game_asset *game_asset)
 {
+	struct res_data *asset;
 	enum asset_key key;
-	time_t since;
+	const char *path;
 
 	for (key = 0; key < ASSET_KEY_COUNT; key++) {
-		since = game_asset->assets[key].since;
-		if (game_asset->assets[key].state == STATE_LOADED)
-			if (res_file_changed(game_asset, &resfiles[key], since))
+		asset = &game_asset->assets[key];
+		if (asset->state != STATE_LOADED)
+			continue;
+		if (asset->watch == WATCH_NONE)
+			res_file_watch(game_asset, key);
+		if (asset->watch == WATCH_POLL &&
+		    res_file_changed(game_asset, &resfiles[key], asset->since))
+			asset_reload(game_asset, key);
+	}
+
+	while ((path = game_asset->file_io->changed())) {
+		for (key = 0; key < ASSET_KEY_COUNT; key++) {
+			asset = &game_asset->assets[key];
+			if (asset->watch == WATCH_NOTIFY && res_file_uses(&resfiles[key], path)) {
+				printf("%s changed\n", path);
 				asset_reload(game_asset, key);
+			}
+		}
 	}
 }
 
@@ -476,6 +910,199 @@ game_asset_init(struct game_asset *game_asset, struct memory_zone *memzone, stru
 	game_asset->samples = samples;
 	game_asset->file_io = file_io;
 	game_asset->tmpzone = tmpzone;
+
+	game_asset->silent_wav = silent_wav;
+	game_asset->silent_wav.audio_data = mempush(memzone, sizeof(tone));
+	memcpy(game_asset->silent_wav.audio_data, tone, sizeof(tone));
+}
+
+/* preload timeline entry, worker is -1 for the main thread */
+struct asset_job {
+	struct game_asset *game_asset;
+	enum asset_key key;
+	struct mesh_data mesh;
+	int64_t size;
+	int ret;
+	int worker;
+	double start, end;
+	double upload_start, upload_end;
+};
+
+static void
+asset_job_load(struct job_worker *worker, void *arg)
+{
+	struct asset_job *job = arg;
+	struct game_asset *game_asset = job->game_asset;
+
+	job->worker = worker->index;
+	job->start = job_time();
+	switch (asset_type(job->key)) {
+	case ASSET_MESH:
+		job->ret = res_load_mesh(game_asset, &worker->scratch, job->key, &job->mesh);
+		break;
+	case ASSET_OGG:
+		res_reload_ogg(game_asset, &worker->scratch, job->key);
+		break;
+	case ASSET_WAV:
+		res_reload_wav(game_asset, job->key);
+		break;
+	default:
+		break;
+	}
+	job->end = job_time();
+}
+
+static void
+asset_timeline(struct asset_job *jobs, size_t count, double t0, int threads)
+{
+	struct asset_job *job, *longest = NULL;
+	double end = t0, busy = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		job = &jobs[i];
+		end = MAX(end, MAX(job->end, job->upload_end));
+		busy += job->end - job->start;
+		if (job->worker >= 0 && (!longest || job->end - job->start > longest->end - longest->start))
+			longest = job;
+	}
+
+	printf("startup: %zu assets in %.2f ms, %d threads, %.2f ms of work\n",
+	       count, (end - t0) * 1000, threads, busy * 1000);
+	for (i = 0; i < count; i++) {
+		job = &jobs[i];
+		if (job->worker >= 0)
+			printf("  worker %d", job->worker);
+		else
+			printf("  main    ");
+		printf(" %8.2f .. %8.2f ms  %s\n", (job->start - t0) * 1000,
+		       (job->end - t0) * 1000, resfiles[job->key].file);
+		if (job->upload_end > job->upload_start)
+			printf("  main     %8.2f .. %8.2f ms  %s (upload)\n",
+			       (job->upload_start - t0) * 1000,
+			       (job->upload_end - t0) * 1000, resfiles[job->key].file);
+	}
+	if (longest)
+		printf("critical path: %s, %.2f ms\n", resfiles[longest->key].file,
+		       (longest->end - longest->start) * 1000);
+}
+
+void
+game_asset_preload(struct game_asset *game_asset, struct memory_zone *scrap)
+{
+	struct memory_zone mem_state = *scrap; /* save memory state */
+	struct asset_job jobs[ASSET_KEY_COUNT] = { 0 };
+	struct asset_job *job, tmp;
+	struct job_pool *pool;
+	enum asset_key key;
+	size_t i, j, count = 0;
+	int threads;
+	double t0;
+
+	t0 = job_time();
+	pool = mempush(scrap, sizeof(*pool));
+	job_pool_init(pool, scrap, job_cpu_count());
+	game_asset->jobs = pool;
+
+	/* file reads, decoding and parsing on the workers */
+	for (key = 0; key < ASSET_KEY_COUNT; key++) {
+		switch (asset_type(key)) {
+		case ASSET_MESH:
+		case ASSET_OGG:
+		case ASSET_WAV:
+			job = &jobs[count++];
+			job->game_asset = game_asset;
+			job->key = key;
+			job->size = game_asset->file_io->size(resfiles[key].file);
+			break;
+		default:
+			break;
+		}
+	}
+	/* biggest files first, they are likely to be the longest jobs */
+	for (i = 1; i < count; i++)
+		for (j = i; j > 0 && jobs[j - 1].size < jobs[j].size; j--) {
+			tmp = jobs[j];
+			jobs[j] = jobs[j - 1];
+			jobs[j - 1] = tmp;
+		}
+	for (i = 0; i < count; i++)
+		job_push(pool, asset_job_load, &jobs[i]);
+
+	/* meanwhile build the shaders, they need the GL context */
+	for (key = 0; key < ASSET_KEY_COUNT; key++) {
+		if (asset_type(key) != ASSET_SHADER)
+			continue;
+		job = &jobs[count++];
+		job->key = key;
+		job->worker = -1;
+		job->start = job_time();
+		asset_reload(game_asset, key);
+		job->end = job_time();
+	}
+
+	job_wait(pool);
+
+	for (i = 0; i < count; i++) {
+		job = &jobs[i];
+		if (asset_type(job->key) != ASSET_MESH || job->ret)
+			continue;
+		job->upload_start = job_time();
+		res_upload_mesh(game_asset, job->key, &job->mesh);
+		job->upload_end = job_time();
+	}
+
+	threads = pool->thread_count;
+	job_pool_fini(pool);
+	game_asset->jobs = NULL;
+
+	asset_timeline(jobs, count, t0, threads);
+
+	/* restore memory zone */
+	*scrap = mem_state;
+}
+
+int
+game_asset_bake(struct game_asset *game_asset, const char *file)
+{
+	struct memory_zone mem_state = game_asset->tmpzone; /* save memory state */
+	struct mesh_data data;
+	struct asset_file blob;
+	char blobname[256];
+	double obj_ms, blob_ms;
+	double start;
+	int ret = -1;
+
+	res_blob_name(blobname, sizeof(blobname), file);
+	data.time = game_asset->file_io->time(file);
+	data.size = game_asset->file_io->size(file);
+
+	start = job_time();
+	if (res_parse_mesh_obj(game_asset, &game_asset->tmpzone, file, &data))
+		goto out;
+	obj_ms = elapsed_ms(start);
+
+	if (res_write_mesh_blob(game_asset, &game_asset->tmpzone, blobname, &data))
+		goto out;
+
+	/* read it back, to check it and compare both path */
+	start = job_time();
+	blob = res_map_file(game_asset, &game_asset->tmpzone, blobname);
+	ret = res_read_mesh_blob(&blob, &data);
+	blob_ms = elapsed_ms(start);
+	res_unmap_file(game_asset, &blob);
+
+	if (ret == 0)
+		printf("%s: %zu vertices, %zu indices, obj %.3f ms (%.1f MB/s), blob %.3f ms\n",
+		       blobname, data.vertex_count, data.index_count,
+		       obj_ms, data.size / (obj_ms * 1000.0), blob_ms);
+out:
+	if (ret)
+		fprintf(stderr, "%s: fail to bake mesh\n", blobname);
+	/* restore memory zone */
+	game_asset->tmpzone = mem_state;
+
+	return ret;
 }
 
 void
@@ -520,6 +1147,7 @@ load_wav(struct wav *wav, char *obj)
 	void *seek = obj;
 	size_t i;
 
+	wav->stream = NULL;
 	for (i = 0; i < 4; i++) {
 		header->riff_str[i] = *((char*) seek);
 		seek += 1;
@@ -585,214 +1213,384 @@ struct vertex_index {
 
 /* We consider only triangulated faces */
 struct face {
-	struct vertex_index v0;
-	struct vertex_index v1;
-	struct vertex_index v2;
+	struct vertex_index v[3];
 };
 
-static struct obj_info
-read_obj_info(struct asset_file *file)
-{
-	struct obj_info info;
-	size_t size = file->size;
-	char *obj = file->data;
-	char *line;
-	size_t i, len = 0;
-	size_t vcount = 0;
-	size_t tcount = 0;
-	size_t ncount = 0;
-	size_t fcount = 0;
-
-	/* count the number of vertices, normals, texcoord and faces */
-	for (i = 0; i < size; i += len) {
-		line = &obj[i];
-		for (len = 0; i + len < size; len++)
-			if (line[len] == '\n' || line[len] == '\0')
-				break;
-		if ((i + len) < size)
-			line[len++] = '\0'; /* replace '\n' with '\0' */
-
-		if (strncmp("v ", line, strlen("v ")) == 0) {
-			vcount++;
-		} else if (strncmp("vt ", line, strlen("vt ")) == 0) {
-			tcount++;
-		} else if (strncmp("vn ", line, strlen("vn ")) == 0) {
-			ncount++;
-		} else if (strncmp("f ", line, strlen("f ")) == 0) {
-			fcount++;
+/* The obj file is parsed in a single pass and without any allocation per
+ * line: attributes are stacked at the bottom of the zone's free space in
+ * the order they appear, triangles are stacked from the top. Once the whole
+ * file is read the attributes are sorted by kind and the vertices are
+ * deduplicated. */
+enum obj_kind {
+	OBJ_V,
+	OBJ_VT,
+	OBJ_VN,
+	OBJ_ATTR_COUNT, /* number of vertex attribute kinds */
+	OBJ_F = OBJ_ATTR_COUNT,
+	OBJ_OTHER,
+};
+
+struct obj_attr {
+	enum obj_kind kind;
+	vec3 v;
+};
+
+struct obj_parser {
+	const char *p;
+	const char *end;
+	size_t line;
+};
+
+static const double obj_pow10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static enum obj_kind
+obj_keyword(const char *word, size_t len)
+{
+	if (len == 1 && word[0] == 'v')
+		return OBJ_V;
+	if (len == 2 && word[0] == 'v' && word[1] == 't')
+		return OBJ_VT;
+	if (len == 2 && word[0] == 'v' && word[1] == 'n')
+		return OBJ_VN;
+	if (len == 1 && word[0] == 'f')
+		return OBJ_F;
+	return OBJ_OTHER;
+}
+
+static int
+obj_isdigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+/* skip blanks and escaped newlines, a line ending with '\' continues on
+ * the next one */
+static void
+obj_skip_blank(struct obj_parser *s)
+{
+	const char *p = s->p;
+
+	while (p < s->end) {
+		if (*p == ' ' || *p == '\t' || *p == '\r') {
+			p++;
+		} else if (*p == '\\' && p + 1 < s->end && p[1] == '\n') {
+			p += 2;
+			s->line++;
+		} else if (*p == '\\' && p + 2 < s->end && p[1] == '\r' && p[2] == '\n') {
+			p += 3;
+			s->line++;
 		} else {
-			/* ingore the line */
+			break;
 		}
 	}
-	info.vert_count = vcount;
-	info.texc_count = tcount;
-	info.norm_count = ncount;
-	info.face_count = fcount;
+	s->p = p;
+}
 
-	return info;
+static void
+obj_skip_line(struct obj_parser *s)
+{
+	for (; s->p < s->end && *s->p != '\n'; s->p++) {
+		if (*s->p != '\\')
+			continue;
+		if (s->p + 1 < s->end && s->p[1] == '\n')
+			s->p++, s->line++;
+		else if (s->p + 2 < s->end && s->p[1] == '\r' && s->p[2] == '\n')
+			s->p += 2, s->line++;
+	}
+	if (s->p < s->end) {
+		s->p++;
+		s->line++;
+	}
+}
+
+static int
+obj_eol(struct obj_parser *s)
+{
+	return s->p >= s->end || *s->p == '\n' || *s->p == '#';
 }
 
-/* TODO: make this return a struct with access to vertex buffers and not directly call load_mesh
- * This will allow to load not only the mesh for rendering but also for physics
- */
+/* parse a decimal number, with optional fraction and exponent */
+static int
+obj_parse_float(struct obj_parser *s, float *out)
+{
+	const char *p = s->p;
+	uint64_t mant = 0;
+	int neg = 0, eneg = 0;
+	int digits = 0, exp = 0, e = 0;
+	double v;
+
+	if (p < s->end && (*p == '-' || *p == '+'))
+		neg = (*p++ == '-');
+	for (; p < s->end && obj_isdigit(*p); p++, digits++) {
+		if (mant < 100000000000000000ull)
+			mant = mant * 10 + (*p - '0');
+		else
+			exp++;
+	}
+	if (p < s->end && *p == '.') {
+		for (p++; p < s->end && obj_isdigit(*p); p++, digits++) {
+			if (mant < 100000000000000000ull) {
+				mant = mant * 10 + (*p - '0');
+				exp--;
+			}
+		}
+	}
+	if (digits == 0)
+		return 0;
+
+	if (p + 1 < s->end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		if (*q == '-' || *q == '+')
+			eneg = (*q++ == '-');
+		if (q < s->end && obj_isdigit(*q)) {
+			for (; q < s->end && obj_isdigit(*q); q++)
+				if (e < 10000)
+					e = e * 10 + (*q - '0');
+			exp += eneg ? -e : e;
+			p = q;
+		}
+	}
+
+	v = mant;
+	for (; exp > 22; exp -= 22)
+		v *= obj_pow10[22];
+	for (; exp < -22; exp += 22)
+		v /= obj_pow10[22];
+	if (exp < 0)
+		v /= obj_pow10[-exp];
+	else
+		v *= obj_pow10[exp];
+
+	*out = neg ? -v : v;
+	s->p = p;
+
+	return 1;
+}
+
+static int
+obj_parse_int(struct obj_parser *s, long *out)
+{
+	const char *p = s->p;
+	long v = 0;
+	int neg = 0;
+
+	if (p < s->end && (*p == '-' || *p == '+'))
+		neg = (*p++ == '-');
+	if (p >= s->end || !obj_isdigit(*p))
+		return 0;
+	for (; p < s->end && obj_isdigit(*p); p++)
+		if (v < 100000000)
+			v = v * 10 + (*p - '0');
+
+	*out = neg ? -v : v;
+	s->p = p;
+
+	return 1;
+}
+
+/* obj indices start from 1, negative ones are relative to the current end
+ * of the list; return 0 for a missing or invalid index */
+static unsigned int
+obj_index(long i, size_t count)
+{
+	if (i < 0)
+		i += count + 1;
+	if (i <= 0 || (size_t)i > count)
+		return 0;
+	return i;
+}
+
+/* parse a face corner, one of: "p", "p/t", "p//n" or "p/t/n" */
+static int
+obj_parse_corner(struct obj_parser *s, size_t *count, struct vertex_index *v)
+{
+	long p, t = 0, n = 0;
+
+	if (!obj_parse_int(s, &p))
+		return 0;
+	if (s->p < s->end && *s->p == '/') {
+		s->p++;
+		if (s->p < s->end && *s->p != '/' && !obj_parse_int(s, &t))
+			return 0;
+		if (s->p < s->end && *s->p == '/') {
+			s->p++;
+			if (!obj_parse_int(s, &n))
+				return 0;
+		}
+	}
+
+	v->p = obj_index(p, count[OBJ_V]);
+	v->t = obj_index(t, count[OBJ_VT]);
+	v->n = obj_index(n, count[OBJ_VN]);
+
+	return v->p != 0;
+}
+
+static unsigned int
+vertex_hash(struct vertex_index v)
+{
+	return (v.p * 73856093u) ^ (v.t * 19349663u) ^ (v.n * 83492791u);
+}
+
+/* Every distinct position/texcoord/normal triplet referenced by the faces
+ * becomes one vertex, polygons are triangulated as fans.
+ * The output is allocated in zone, along with temporary buffers: the
+ * caller is expected to restore the zone once done with it. */
 static void
-load_obj(struct memory_zone *zone, struct asset_file *file, struct obj_info info,
-	 size_t count, float *out_vert, float *out_norm, float *out_texc)
-{
-	struct memory_zone memory_state = *zone;
-	size_t size = file->size;
-	char *obj = file->data;
-	char *line;
-	int verbose = 0;
-	size_t i, len = 0;
-	size_t vcount = 0;
-	size_t tcount = 0;
-	size_t ncount = 0;
-	size_t fcount = 0;
+load_obj(struct memory_zone *zone, struct asset_file *file, struct obj_data *out)
+{
+	struct obj_parser s = { file->data, file->data + file->size, 1 };
+	struct obj_attr *attr = (void *)(zone->base + zone->used);
+	struct face *top = (void *)(zone->base + zone->size);
+	size_t count[OBJ_ATTR_COUNT] = { 0 };
+	size_t acount = 0, fcount = 0, fstart;
+	size_t zone_size = zone->size;
+	struct vertex_index first, prev, cur;
+	enum obj_kind kind;
+	const char *word;
+	size_t i, k;
 	vec3 *obj_vert;
 	vec3 *obj_texc;
 	vec3 *obj_norm;
-	struct face *obj_face;
-	float x, y, z;
-	int p0, p1, p2, t0, t1, t2, n0, n1, n2;
-	int n;
-
-	/* allocate temporary buffer for parsing the obj file */
-	obj_vert = mempush(zone, info.vert_count * sizeof(*obj_vert));
-	obj_texc = mempush(zone, info.texc_count * sizeof(*obj_texc));
-	obj_norm = mempush(zone, info.norm_count * sizeof(*obj_norm));
-	obj_face = mempush(zone, info.face_count * sizeof(*obj_face));
-
-	for (i = 0; i < size; i += len) {
-		line = &obj[i];
-		for (len = 0; (i + len) < size; len++)
-			if (line[len] == '\n' || line[len] == '\0')
-				break;
-		if ((i + len) < size)
-			line[len++] = '\0'; /* replace '\n' with '\0' */
-
-		// TODO: line ending with / are continuated;
-		if (strncmp("v ", line, strlen("v ")) == 0) {
-			n = sscanf(line, "v %f %f %f", &x, &y, &z);
-			if (n == 3) {
-				if (verbose)
-					printf("v %f %f %f\n", x, y, z);
-				obj_vert[vcount++] = (vec3) {x, y, z};
-			} else {
-				fprintf(stderr, "Malformed line starting with 'v '\n");
+	float *f;
+	struct vertex_index *unique;
+	unsigned int *htable;
+	size_t h, hsize, ucount;
+
+	while (s.p < s.end) {
+		obj_skip_blank(&s);
+		word = s.p;
+		while (s.p < s.end && *s.p != ' ' && *s.p != '\t' && *s.p != '\r' && *s.p != '\n')
+			s.p++;
+		kind = obj_keyword(word, s.p - word);
+
+		switch (kind) {
+		case OBJ_V:
+		case OBJ_VT:
+		case OBJ_VN:
+			/* texture coordinates may have one to three components,
+			 * extra position components (w or colors) are ignored */
+			if ((void *)(attr + acount + 1) > (void *)(top - fcount))
+				die("load_obj: Not enough memory\n");
+			f = &attr[acount].v.x;
+			f[0] = f[1] = f[2] = 0;
+			for (k = 0; k < 3; k++) {
+				obj_skip_blank(&s);
+				if (!obj_parse_float(&s, &f[k]))
+					break;
 			}
-		} else if (strncmp("vt ", line, strlen("vt ")) == 0) {
-			/*
-			  We assume all textures are 2D textures:
-			  We look for lines of the form
-			  "vt u v \n"
-			  with:
-			  - u the value for the horizontal direction
-			  - v the value for the vertical direction
-			  TODO: accept 1D, 2D, 3D textures
-			  i.e lines of form:
-			  "vt u \n"
-			  "vt u v \n"
-			  "vt u v w \n"
-			 */
-			n = sscanf(line, "vt %f %f", &x, &y);
-			if (n == 2) {
-				if (verbose)
-					printf("vt %f %f \n", x, y);
-				obj_texc[tcount++] = (vec3) {x, y, 0};
+			if (k == 3 || (kind == OBJ_VT && k >= 1)) {
+				attr[acount++].kind = kind;
+				count[kind]++;
 			} else {
-				fprintf(stderr, "Malformed line starting with 'vt '\n");
+				fprintf(stderr, "%s:%zu: malformed vertex\n", file->name, s.line);
 			}
-		} else if (strncmp("vn ", line, strlen("vn ")) == 0) {
-			n = sscanf(line, "vn %f %f %f", &x, &y, &z);
-			if (n == 3) {
-				if (verbose)
-					printf("vn %f %f %f \n", x, y, z);
-				obj_norm[ncount++] = (vec3) {x, y, z};
-			} else {
-				fprintf(stderr, "Malformed line starting with 'vn '\n");
-			}
-		} else if (strncmp("f ", line, strlen("f ")) == 0) {
-			/* A face line starts with 'f' and is followed by triplets
-			   of the form "vertex/texcoord/normal".
-			   Example, for a mesh with triangular faces:
-			   "f a1/b1/c1 a2/b2/c2 a3/b3/c3 \n"
-			   With:
-			   - a is the index of a vertex in the obj file vertex list
-			   - b is the index of a texture coordinate in the obj texcoords list
-			   - c is the index of a normal in the obj file normal list
-			   Rem:
-			   - in obj files, indices starts from 1
-			   arrays indices start from 0 hence the Vertices[a-1] bellow.
-			   - For now we only accept mesh with triangular faces.
-			   Todo: accept more cellular division by adapting
-			   format string fmt bellow.
-			   - We assume texture coordinates and normal are present
-			   Todo: accept faces lines of the form
-			   - "f a1 a2 a3 \n"
-			   - "f a1/b1 a2/b2 a3/b3 \n"
-			   - "f a1/c1 a2/c2 a3/c3 \n"
-			*/
-			n = sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d",
-				   &p0,&t0,&n0, &p1,&t1,&n1, &p2,&t2,&n2);
-			if (n != 9) {
-				/* without textcoord */
-				t0 = t1 = t2 = 0;
-				n = sscanf(line, "f %d//%d %d//%d %d//%d",
-					   &p0,&n0, &p1,&n1, &p2,&n2);
+			break;
+		case OBJ_F:
+			fstart = fcount;
+			for (k = 0; ; k++) {
+				obj_skip_blank(&s);
+				if (obj_eol(&s) || !obj_parse_corner(&s, count, &cur))
+					break;
+				if (k == 0) {
+					first = cur;
+				} else if (k >= 2) {
+					if ((void *)(top - fcount - 1) < (void *)(attr + acount))
+						die("load_obj: Not enough memory\n");
+					fcount++;
+					top[-fcount] = (struct face) {{ first, prev, cur }};
+				}
+				prev = cur;
 			}
-			if (n == 9 || n == 6) {
-				struct face f = {{p0, t0, n0}, {p1, t1, n1},  {p2, t2, n2}};
-				if (verbose)
-					printf("f %d/%d/%d %d/%d/%d %d/%d/%d \n",
-					       p0,t0,n0, p1,t1,n1, p2,t2,n2);
-				obj_face[fcount++] = f;
-			} else {
-				fprintf(stderr, "Malformed line starting with 'f '\n");
+			if (!obj_eol(&s) || k < 3) {
+				fprintf(stderr, "%s:%zu: malformed face\n", file->name, s.line);
+				fcount = fstart;
 			}
-		} else {
-			/* ingore the line */
+			break;
+		default:
+			/* ignore the line */
+			break;
 		}
+		obj_skip_line(&s);
 	}
 
-	fcount = MIN(fcount, count);
-	if (out_vert) {
-		for (i = 0; i < fcount; i++) {
-			out_vert[i*9 + 0] = obj_vert[obj_face[i].v0.p - 1].x;
-			out_vert[i*9 + 1] = obj_vert[obj_face[i].v0.p - 1].y;
-			out_vert[i*9 + 2] = obj_vert[obj_face[i].v0.p - 1].z;
-			out_vert[i*9 + 3] = obj_vert[obj_face[i].v1.p - 1].x;
-			out_vert[i*9 + 4] = obj_vert[obj_face[i].v1.p - 1].y;
-			out_vert[i*9 + 5] = obj_vert[obj_face[i].v1.p - 1].z;
-			out_vert[i*9 + 6] = obj_vert[obj_face[i].v2.p - 1].x;
-			out_vert[i*9 + 7] = obj_vert[obj_face[i].v2.p - 1].y;
-			out_vert[i*9 + 8] = obj_vert[obj_face[i].v2.p - 1].z;
+	/* faces are kept at the top of the zone until deduplicated */
+	zone->used = (void *)(attr + acount) - zone->base;
+	zone->size = (void *)(top - fcount) - zone->base;
+
+	/* sort attributes by kind */
+	obj_vert = mempush(zone, count[OBJ_V] * sizeof(*obj_vert));
+	obj_texc = mempush(zone, count[OBJ_VT] * sizeof(*obj_texc));
+	obj_norm = mempush(zone, count[OBJ_VN] * sizeof(*obj_norm));
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < acount; i++) {
+		switch (attr[i].kind) {
+		case OBJ_V:  obj_vert[count[OBJ_V]++]  = attr[i].v; break;
+		case OBJ_VT: obj_texc[count[OBJ_VT]++] = attr[i].v; break;
+		case OBJ_VN: obj_norm[count[OBJ_VN]++] = attr[i].v; break;
+		default: break;
 		}
 	}
-	if (out_norm && ncount > 0) {
-		for (i = 0; i < fcount; i++) {
-			out_norm[i*9 + 0] = obj_norm[obj_face[i].v0.n - 1].x;
-			out_norm[i*9 + 1] = obj_norm[obj_face[i].v0.n - 1].y;
-			out_norm[i*9 + 2] = obj_norm[obj_face[i].v0.n - 1].z;
-			out_norm[i*9 + 3] = obj_norm[obj_face[i].v1.n - 1].x;
-			out_norm[i*9 + 4] = obj_norm[obj_face[i].v1.n - 1].y;
-			out_norm[i*9 + 5] = obj_norm[obj_face[i].v1.n - 1].z;
-			out_norm[i*9 + 6] = obj_norm[obj_face[i].v2.n - 1].x;
-			out_norm[i*9 + 7] = obj_norm[obj_face[i].v2.n - 1].y;
-			out_norm[i*9 + 8] = obj_norm[obj_face[i].v2.n - 1].z;
+
+	/* deduplicate vertices with an open addressing hash table of
+	 * indices into the unique vertex list, 0 mark an empty slot */
+	for (hsize = 1; hsize < 2 * 3 * fcount; hsize <<= 1)
+		;
+	htable = mempush(zone, hsize * sizeof(*htable));
+	memset(htable, 0, hsize * sizeof(*htable));
+	unique = mempush(zone, 3 * fcount * sizeof(*unique));
+	out->indices = mempush(zone, 3 * fcount * sizeof(*out->indices));
+	out->index_count = 3 * fcount;
+	ucount = 0;
+
+	for (i = 0; i < 3 * fcount; i++) {
+		struct vertex_index v = top[-1 - (long)(i / 3)].v[i % 3];
+
+		for (h = vertex_hash(v) & (hsize - 1); htable[h]; h = (h + 1) & (hsize - 1)) {
+			struct vertex_index *u = &unique[htable[h] - 1];
+			if (u->p == v.p && u->t == v.t && u->n == v.n)
+				break;
 		}
-	}
-	if (out_texc && tcount > 0) {
-		for (i = 0; i < fcount; i++) {
-			out_texc[i*6 + 0] = obj_texc[obj_face[i].v0.t - 1].x;
-			out_texc[i*6 + 1] = obj_texc[obj_face[i].v0.t - 1].y;
-			out_texc[i*6 + 2] = obj_texc[obj_face[i].v1.t - 1].x;
-			out_texc[i*6 + 3] = obj_texc[obj_face[i].v1.t - 1].y;
-			out_texc[i*6 + 4] = obj_texc[obj_face[i].v2.t - 1].x;
-			out_texc[i*6 + 5] = obj_texc[obj_face[i].v2.t - 1].y;
+		if (!htable[h]) {
+			unique[ucount++] = v;
+			htable[h] = ucount;
 		}
+		out->indices[i] = htable[h] - 1;
 	}
 
-	/* restore memory state */
-	*zone = memory_state;
+	/* faces are not needed anymore */
+	zone->size = zone_size;
+
+	out->vertex_count = ucount;
+	out->positions = mempush(zone, ucount * 3 * sizeof(float));
+	out->normals = NULL;
+	if (count[OBJ_VN] > 0)
+		out->normals = mempush(zone, ucount * 3 * sizeof(float));
+	out->texcoords = NULL;
+	if (count[OBJ_VT] > 0)
+		out->texcoords = mempush(zone, ucount * 2 * sizeof(float));
+
+	for (i = 0; i < ucount; i++) {
+		struct vertex_index v = unique[i];
+		vec3 zero = { 0 };
+		vec3 p = obj_vert[v.p - 1];
+		vec3 t = v.t ? obj_texc[v.t - 1] : zero;
+		vec3 n = v.n ? obj_norm[v.n - 1] : zero;
+
+		out->positions[i*3 + 0] = p.x;
+		out->positions[i*3 + 1] = p.y;
+		out->positions[i*3 + 2] = p.z;
+		if (out->normals) {
+			out->normals[i*3 + 0] = n.x;
+			out->normals[i*3 + 1] = n.y;
+			out->normals[i*3 + 2] = n.z;
+		}
+		if (out->texcoords) {
+			out->texcoords[i*2 + 0] = t.x;
+			out->texcoords[i*2 + 1] = t.y;
+		}
+	}
 }
@@ -37,25 +37,47 @@ enum asset_state {
 	STATE_LOADED,
 };
 
+/* how the asset files are checked for changes */
+enum asset_watch {
+	WATCH_NONE, /* not registered yet */
+	WATCH_NOTIFY, /* reported by file_io->changed */
+	WATCH_POLL, /* time checked every poll */
+};
+
 struct game_asset {
 	struct memory_zone *memzone;
 	struct memory_zone  tmpzone;
 	struct memory_zone *samples;
 	struct file_io *file_io;
+	struct job_pool *jobs; /* set while preloading */
 	struct res_data {
 		enum asset_state state;
+		enum asset_watch watch;
 		time_t since;
 		size_t size;
 		void *base;
 	} assets[ASSET_KEY_COUNT];
+	/* played for missing sounds, kept in game memory so the mixer does
+	 * not point into a library that was reloaded */
+	struct wav silent_wav;
 };
 
 void game_asset_init(struct game_asset *game_asset, struct memory_zone *memzone, struct memory_zone *samples, struct file_io *file_io);
 void game_asset_fini(struct game_asset *game_asset);
 void game_asset_poll(struct game_asset *game_asset);
+/* load every asset at once, using worker threads and scrap memory */
+void game_asset_preload(struct game_asset *game_asset, struct memory_zone *scrap);
+/* parse an obj file and write its baked mesh next to it */
+int game_asset_bake(struct game_asset *game_asset, const char *file);
 
+/* load the asset if missing: GL thread, never while a frame is built */
 struct shader *game_get_shader(struct game_asset *game_asset, enum asset_key key);
 struct mesh *game_get_mesh(struct game_asset *game_asset, enum asset_key key);
+/* NULL unless loaded, never loads */
+struct shader *game_find_shader(struct game_asset *game_asset, enum asset_key key);
+struct mesh *game_find_mesh(struct game_asset *game_asset, enum asset_key key);
+/* built in the asset zone on the first call, not while preloading */
+struct bvh *game_get_mesh_bvh(struct game_asset *game_asset, struct mesh *mesh);
 struct wav *game_get_wav(struct game_asset *game_asset, enum asset_key key);
 
 #endif
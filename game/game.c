@@ -14,75 +14,93 @@
 #define GL_LINE 0
 #define GL_FILL 1
 
-static float
-ray_distance_to_plane(vec3 org, vec3 dir, vec4 plane)
-{
-	/* p on ray   : p = t * dir + org */
-	/* p on plane : (p-s) . n = 0 */
-	/* t = (s-o).n / d.n */
-	vec3 n = { plane.x , plane.y, plane.z };
-	vec3 s = vec3_mult(plane.w, n);
-	return vec3_dot(vec3_sub(s, org), n) / vec3_dot(dir, n);
-}
-
-static int
-point_in_triangle(vec3 q, vec3 a, vec3 b, vec3 c)
-{
-	/* triangle:
-	 *      + c
-	 *     / \
-	 *    /   \
-	 * a +-----+ b
-	 */
-	/* n = (b - a) x (c - a) */
-	vec3 n = vec3_normalize(vec3_cross(vec3_sub(b, a), vec3_sub(c, a)));
-	vec3 e1 = vec3_sub(b, a);
-	vec3 e2 = vec3_sub(c, b);
-	vec3 e3 = vec3_sub(a, c);
-	vec3 qa = vec3_sub(q, a);
-	vec3 qb = vec3_sub(q, b);
-	vec3 qc = vec3_sub(q, c);
-	vec3 x1 = vec3_cross(e1, qa);
-	vec3 x2 = vec3_cross(e2, qb);
-	vec3 x3 = vec3_cross(e3, qc);
-
-	return vec3_dot(x1, n) >= 0
-		&& vec3_dot(x2, n) >= 0
-		&& vec3_dot(x3, n) >= 0;
-}
-
 static vec4
-ray_intersect_mesh(vec3 org, vec3 dir, struct mesh *mesh, mat4 *xfrm)
+ray_intersect_mesh(struct game_asset *game_asset, vec3 org, vec3 dir, struct mesh *mesh, mat4 *xfrm)
 {
+	struct bvh *bvh = game_get_mesh_bvh(game_asset, mesh);
 	vec4 q = { 0 };
-	unsigned int i;
 	float dist = 10000.0; /* TODO: find a sane max value */
-	float *pos = mesh->positions;
-
-	if (!pos)
+	float (*m)[4] = xfrm->m;
+	/* the rows of the linear part, as applied by mat4_mult_vec3 */
+	vec3 r0 = { m[0][0], m[0][1], m[0][2] };
+	vec3 r1 = { m[1][0], m[1][1], m[1][2] };
+	vec3 r2 = { m[2][0], m[2][1], m[2][2] };
+	vec3 c0 = vec3_cross(r1, r2);
+	vec3 c1 = vec3_cross(r2, r0);
+	vec3 c2 = vec3_cross(r0, r1);
+	float det = vec3_dot(r0, c0);
+	vec3 o, d;
+
+	if (bvh->node_count == 0 || det == 0)
 		return q;
-	if (mesh->primitive != GL_TRIANGLES)
-		return q; /* not triangulated, need indexes as well */
-
-	for (i = 0; i < mesh->vertex_count; i += 3) {
-		size_t idx = i * 3;
-		vec3 t1 = mat4_mult_vec3(xfrm, (vec3){ pos[idx + 0], pos[idx + 1], pos[idx + 2] });
-		vec3 t2 = mat4_mult_vec3(xfrm, (vec3){ pos[idx + 3], pos[idx + 4], pos[idx + 5] });
-		vec3 t3 = mat4_mult_vec3(xfrm, (vec3){ pos[idx + 6], pos[idx + 7], pos[idx + 8] });
-		vec3 n = vec3_normalize(vec3_cross(vec3_sub(t2, t1), vec3_sub(t3, t1)));
-		vec4 plane = { n.x, n.y, n.z, vec3_dot(t1, n)};
-		float d = ray_distance_to_plane(org, dir, plane);
-		if (d >= 0 && d < dist) {
-			vec3 p = vec3_add(vec3_mult(d, dir), org);
-			if (point_in_triangle(p, t1, t2, t3)) {
-				dist = d;
-				q = (vec4) { p.x, p.y, p.z, d };
-			}
-		}
+
+	/* move the ray in mesh space rather than every triangle in world
+	 * space, the transform is affine: the hit distance stays the same */
+	o = vec3_sub(org, (vec3){ m[3][0], m[3][1], m[3][2] });
+	o = vec3_mult(1 / det, vec3_add(vec3_add(vec3_mult(o.x, c0), vec3_mult(o.y, c1)), vec3_mult(o.z, c2)));
+	d = vec3_mult(1 / det, vec3_add(vec3_add(vec3_mult(dir.x, c0), vec3_mult(dir.y, c1)), vec3_mult(dir.z, c2)));
+
+	if (bvh_intersect(bvh, o, d, &dist)) {
+		vec3 p = vec3_add(vec3_mult(dist, dir), org);
+		q = (vec4) { p.x, p.y, p.z, dist };
 	}
+
 	return q;
 }
 
+enum entity_type {
+	ENTITY_GAME,
+	ENTITY_SCREEN,
+	ENTITY_UI,
+	ENTITY_DEBUG,
+	ENTITY_COUNT
+};
+
+struct entity {
+	enum entity_type type;
+	enum asset_key shader;
+	enum asset_key mesh;
+	int mode; /* GL_LINE of GL_FILL */
+	quaternion rotation;
+	vec3 position;
+	vec3 scale;
+	vec3 color;
+};
+
+struct render_stats {
+	unsigned int entities;
+	unsigned int culled;
+	unsigned int gl_calls;
+	unsigned int draw_calls;
+	unsigned int instances;
+	unsigned int state_changes;          /* after sorting */
+	unsigned int state_changes_unsorted; /* in submission order */
+};
+
+struct render_queue {
+	struct memory_zone zone;
+	size_t count;
+	struct render_stats stats;
+	struct game_asset *game_asset;
+	/* constant for the frame, copied once built: the queue no longer
+	 * depends on the game state, which moves on to the next frame */
+	struct camera cam;
+	float time;
+	unsigned int width, height;
+	int debug;
+	GLuint instance_vbo;
+};
+
+/* a game step as the GL stage sees it, see game_step */
+struct frame {
+	struct render_queue queue;
+	int state;
+	int cursor; /* shown */
+	int close; /* the window, the build cannot call window_io */
+	unsigned int ticks;
+	double build_time;
+};
+
 struct texture {
 	GLuint id;
 	GLenum type;
@@ -94,6 +112,23 @@ struct game_state {
 	struct input input;
 	struct window_io *window_io;
 	float last_time;
+	float last_report;
+	double mix_time; /* mixer counters at the last report */
+	size_t mix_frames;
+	size_t mix_voice_frames;
+	unsigned long file_calls; /* file system calls at the last report */
+	unsigned int frames; /* since the last report */
+	unsigned int ticks;
+	double build_time, wait_time, submit_time, present_time;
+	double tick_time; /* left to simulate, less than a tick */
+
+	/* the frame job builds a frame while the GL stage draws the other */
+	struct frame frame[2];
+	unsigned int frame_count; /* frames built or being built */
+	struct input frame_input; /* of the frame being built */
+	double frame_end; /* when the GL stage gave back to the platform */
+	unsigned int viewport_width, viewport_height;
+	int cursor, cursor_shown;
 
 	enum {
 		GAME_INIT,
@@ -108,6 +143,7 @@ struct game_state {
 	int menu_selection;
 
 	struct camera cam;
+	GLuint instance_vbo; /* per-instance attributes of the current draw */
 	int flycam;
 	int flycam_forward, flycam_left;
 	float flycam_speed;
@@ -116,27 +152,14 @@ struct game_state {
 	quaternion player_dir;
 	float player_lookup;
 	vec3 player_pos;
+	vec3 player_prev_pos; /* at the previous tick, to interpolate */
 	vec3 player_new_pos;
 	float player_speed;
 	vec3 player_aim;
+	vec3 player_prev_aim;
 
-	struct sampler theme_sampler;
-	struct wav *theme_wav;
-
-	struct sampler casey_sampler;
-	struct wav *casey_wav;
-
-	struct sampler wind_sampler;
-	struct wav *wind_wav;
-
-	struct sampler menu_sampler;
-	struct wav *menu_wav;
-
-	struct sampler woosh_sampler[4];
-	struct wav *woosh_wav[4];
-
-	struct sampler crash_sampler[4];
-	struct wav *crash_wav[4];
+	/* played on the audio thread, see game_audio */
+	struct mixer mixer;
 
 	int debug;
 	int key_debug;
@@ -181,6 +204,30 @@ create_2d_tex(size_t w, size_t h, void *data)
 	return tex;
 }
 
+/* mixer groups */
+enum audio_group {
+	AUDIO_MUSIC,
+	AUDIO_AMBIENCE,
+	AUDIO_SFX,
+};
+
+#define AUDIO_VOICES 32
+
+/* the game is simulated at a fixed rate, whatever the frame rate */
+#define GAME_TICK      (1.0 / 120.0)
+#define GAME_MAX_TICKS 8
+
+/* the sound effects only play in game, the music everywhere else */
+static void
+game_audio_play(struct game_state *game_state, int play)
+{
+	struct mixer *mixer = &game_state->mixer;
+
+	mixer_push_group(mixer, MIXER_PAUSE, AUDIO_AMBIENCE, !play);
+	mixer_push_group(mixer, MIXER_PAUSE, AUDIO_SFX, !play);
+	mixer_push_group(mixer, MIXER_PAUSE, AUDIO_MUSIC, play);
+}
+
 void
 game_init(struct game_memory *game_memory, struct file_io *file_io, struct window_io *win_io)
 {
@@ -192,90 +239,98 @@ game_init(struct game_memory *game_memory, struct file_io *file_io, struct windo
 
 	game_state->game_asset = game_asset;
 	game_asset_init(game_asset, &game_memory->asset, &game_memory->audio, file_io);
+	game_asset_preload(game_asset, &game_memory->scrap);
 
 	camera_init(&game_state->cam, 1.05, 1);
 	camera_set(&game_state->cam, (vec3){0, 1, -5}, QUATERNION_IDENTITY);
 	game_state->flycam_speed = 1;
 
+	glGenBuffers(1, &game_state->instance_vbo);
+	for (int i = 0; i < 2; i++) {
+		game_state->frame[i].queue.zone.base = mempush(&game_memory->state, SZ_4M);
+		game_state->frame[i].queue.zone.size = SZ_4M;
+	}
+	game_state->cursor = game_state->cursor_shown = 1;
+
 	game_state->window_io = win_io;
 	game_state->state = GAME_INIT;
 	game_state->new_state = GAME_MENU;
 
 	/* audio */
-	game_state->theme_wav = game_get_wav(game_asset, WAV_THEME);
-	sampler_init(&game_state->theme_sampler, game_state->theme_wav);
-	game_state->theme_sampler.loop_on = 1;
-	game_state->theme_sampler.trig_on = 1;
-
-	game_state->casey_wav = game_get_wav(game_asset, WAV_CASEY);
-	sampler_init(&game_state->casey_sampler, game_state->casey_wav);
-	game_state->casey_sampler.loop_on = 1;
-	game_state->casey_sampler.trig_on = 1;
-	game_state->casey_sampler.vol = 0.8;
-	game_state->casey_sampler.loop_start = 7899500 * 2;
-
-	game_state->wind_wav = game_get_wav(game_asset, WAV_WIND);
-	sampler_init(&game_state->wind_sampler, game_state->wind_wav);
-	game_state->wind_sampler.loop_on = 1;
-	game_state->wind_sampler.trig_on = 1;
-	game_state->wind_sampler.loop_start = 805661 * 2; /* Loop start after fadein */
-
-	game_state->menu_wav = game_get_wav(game_asset, WAV_MENU);
-	sampler_init(&game_state->menu_sampler, game_state->menu_wav);
-	game_state->menu_sampler.vol = 0.3;
-
+	struct mixer *mixer = &game_state->mixer;
+	mixer_init(mixer, &game_memory->audio, AUDIO_VOICES, ASSET_KEY_COUNT, 0.2);
+
+	mixer_sound(mixer, WAV_THEME, (struct mixer_sound){
+		.wav = game_get_wav(game_asset, WAV_THEME),
+		.gain = 1, .priority = 2, .group = AUDIO_MUSIC,
+		.loop_on = 1,
+	});
+	mixer_sound(mixer, WAV_CASEY, (struct mixer_sound){
+		.wav = game_get_wav(game_asset, WAV_CASEY),
+		.gain = 0.8, .priority = 2, .group = AUDIO_MUSIC,
+		.loop_on = 1, .loop_start = 7899500 * 2,
+	});
+	mixer_sound(mixer, WAV_WIND, (struct mixer_sound){
+		.wav = game_get_wav(game_asset, WAV_WIND),
+		.gain = 1, .priority = 2, .group = AUDIO_AMBIENCE,
+		.loop_on = 1, .loop_start = 805661 * 2, /* Loop start after fadein */
+	});
+	mixer_sound(mixer, WAV_MENU, (struct mixer_sound){
+		.wav = game_get_wav(game_asset, WAV_MENU),
+		.gain = 0.3, .priority = 1, .group = AUDIO_MUSIC,
+	});
 	for (size_t i = 0; i < 4; i++) {
-		game_state->woosh_wav[i] =
-			game_get_wav(game_asset, WAV_WOOSH_00 + i);
-		sampler_init(&game_state->woosh_sampler[i],
-			     game_state->woosh_wav[i]);
-		game_state->woosh_sampler[i].vol = 0.4;
-	}
-	for (size_t i = 0; i < 4; i++) {
-		game_state->crash_wav[i] =
-			game_get_wav(game_asset, WAV_CRASH_00 + i);
-		sampler_init(&game_state->crash_sampler[i],
-			     game_state->crash_wav[i]);
-		game_state->crash_sampler[i].vol = 0.4;
+		mixer_sound(mixer, WAV_WOOSH_00 + i, (struct mixer_sound){
+			.wav = game_get_wav(game_asset, WAV_WOOSH_00 + i),
+			.gain = 0.4, .priority = 0, .group = AUDIO_SFX,
+		});
+		mixer_sound(mixer, WAV_CRASH_00 + i, (struct mixer_sound){
+			.wav = game_get_wav(game_asset, WAV_CRASH_00 + i),
+			.gain = 0.4, .priority = 1, .group = AUDIO_SFX,
+		});
 	}
+
+	mixer_play(mixer, WAV_THEME, 1, 0);
+	mixer_play(mixer, WAV_CASEY, 1, 0);
+	mixer_play(mixer, WAV_WIND, 1, 0);
+	game_audio_play(game_state, 0);
 }
 
 void
 game_fini(struct game_memory *memory)
 {
+	struct game_state *game_state = memory->state.base;
 	struct game_asset *game_asset = memory->asset.base;
+	struct mixer *mixer = &game_state->mixer;
+
+	/* the audio thread is stopped, the counters hold the whole run */
+	if (mixer->frames > 0)
+		printf("audio: %zu frames mixed in %.3f s, %.0f frames/s, "
+		       "%.1f ns/frame per voice\n",
+		       mixer->frames, mixer->time, mixer->frames / mixer->time,
+		       mixer->time * 1e9 / MAX(1, mixer->voice_frames));
 	game_asset_fini(game_asset);
 }
 
-enum entity_type {
-	ENTITY_GAME,
-	ENTITY_SCREEN,
-	ENTITY_UI,
-	ENTITY_DEBUG,
-	ENTITY_COUNT
-};
+int
+game_bake(struct game_memory *game_memory, struct file_io *file_io, const char *path)
+{
+	struct memory_zone mem_state = game_memory->asset; /* save memory state */
+	struct game_asset *game_asset;
+	int ret;
 
-struct entity {
-	enum entity_type type;
-	enum asset_key shader;
-	enum asset_key mesh;
-	int mode; /* GL_LINE of GL_FILL */
-	quaternion rotation;
-	vec3 position;
-	vec3 scale;
-	vec3 color;
-};
+	game_asset = mempush(&game_memory->asset, sizeof(struct game_asset));
+	game_asset_init(game_asset, &game_memory->asset, &game_memory->audio, file_io);
+	ret = game_asset_bake(game_asset, path);
 
-struct render_queue {
-	struct memory_zone zone;
-	size_t count;
-	struct game_state *game_state;
-	struct game_asset *game_asset;
-};
+	/* restore memory zone */
+	game_memory->asset = mem_state;
+
+	return ret;
+}
 
 static void
 render_queue_init(struct render_queue *queue,
-		  struct game_state *game_state,
 		  struct game_asset *game_asset,
 		  void *base, size_t size)
 {
@@ -283,10 +338,21 @@ render_queue_init(struct render_queue *queue,
 	queue->zone.size = size;
 	queue->zone.used = 0;
 	queue->count = 0;
-	queue->game_state = game_state;
+	queue->stats = (struct render_stats){ 0 };
 	queue->game_asset = game_asset;
 }
 
+static void
+render_queue_close(struct render_queue *queue, struct game_state *game_state)
+{
+	queue->cam = game_state->cam;
+	queue->time = game_state->last_time;
+	queue->width = game_state->input.width;
+	queue->height = game_state->input.height;
+	queue->debug = game_state->debug;
+	queue->instance_vbo = game_state->instance_vbo;
+}
+
 static void
 render_queue_push(struct render_queue *queue, struct entity *entity)
 {
@@ -297,122 +363,262 @@ render_queue_push(struct render_queue *queue, struct entity *entity)
 	queue->count++;
 }
 
-static void
-render_bind_shader(struct shader *shader)
+/* Sort key layout, from most to least significant:
+ *   63..56 entity type   (draw order between layers)
+ *   55..48 shader
+ *   47..40 mesh
+ *   39..32 polygon mode
+ *   31..0  queue index   (keep submission order for equal states)
+ */
+#define RENDER_KEY_INDEX_MASK 0xffffffffULL
+#define RENDER_KEY_STATE_SHIFT 32
+
+static uint64_t
+render_key(struct entity *e, uint32_t index)
 {
-	/* Set the current shader program to shader->prog */
-	glUseProgram(shader->prog);
+	uint64_t key = index;
+
+	key |= (uint64_t)(e->type   & 0xff) << 56;
+	key |= (uint64_t)(e->shader & 0xff) << 48;
+	key |= (uint64_t)(e->mesh   & 0xff) << 40;
+	key |= (uint64_t)(e->mode   & 0xff) << 32;
+
+	return key;
 }
 
-static void
-render_bind_mesh(struct shader *shader, struct mesh *mesh)
+static unsigned int
+render_state_changes(uint64_t *keys, size_t count)
+{
+	unsigned int changes = 0;
+	uint64_t shader, mesh;
+	uint64_t last_shader = ~0ULL;
+	uint64_t last_mesh = ~0ULL;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		shader = (keys[i] >> 48) & 0xff;
+		mesh = (keys[i] >> 40) & 0xff;
+		if (shader != last_shader) {
+			/* a program switch also forces a mesh bind */
+			changes += 2;
+			last_shader = shader;
+			last_mesh = mesh;
+		} else if (mesh != last_mesh) {
+			changes += 1;
+			last_mesh = mesh;
+		}
+	}
+
+	return changes;
+}
+
+/* LSD radix sort on the state bytes of the keys, the index bytes are
+ * already in increasing order so they don't need to be sorted. */
+static uint64_t *
+render_radix_sort(uint64_t *keys, uint64_t *tmp, size_t count)
+{
+	size_t hist[256];
+	size_t i, sum, n;
+	uint64_t *swap;
+	unsigned int shift;
+
+	for (shift = RENDER_KEY_STATE_SHIFT; shift < 64; shift += 8) {
+		memset(hist, 0, sizeof(hist));
+		for (i = 0; i < count; i++)
+			hist[(keys[i] >> shift) & 0xff]++;
+
+		/* every key share this byte, nothing to move */
+		if (count == 0 || hist[(keys[0] >> shift) & 0xff] == count)
+			continue;
+
+		for (i = 0, sum = 0; i < 256; i++) {
+			n = hist[i];
+			hist[i] = sum;
+			sum += n;
+		}
+		for (i = 0; i < count; i++)
+			tmp[hist[(keys[i] >> shift) & 0xff]++] = keys[i];
+
+		swap = keys;
+		keys = tmp;
+		tmp = swap;
+	}
+
+	return keys;
+}
+
+/* Build the sorted list of keys for the visible entries of the queue,
+ * the keys are allocated in the queue zone. */
+static size_t
+render_queue_sort(struct render_queue *queue, uint64_t **out)
 {
-	GLint position;
-	GLint normal;
-	GLint texcoord;
+	struct entity *entry = queue->zone.base;
+	uint64_t *keys, *tmp;
+	size_t i, count = 0;
+
+	keys = mempush(&queue->zone, queue->count * sizeof(*keys));
+	tmp = mempush(&queue->zone, queue->count * sizeof(*tmp));
+
+	for (i = 0; i < queue->count; i++) {
+		if (!queue->debug && entry[i].type == ENTITY_DEBUG)
+			continue;
+		keys[count++] = render_key(&entry[i], i);
+	}
 
-	position = glGetAttribLocation(shader->prog, "in_pos");
-	normal = glGetAttribLocation(shader->prog, "in_normal");
-	texcoord = glGetAttribLocation(shader->prog, "in_texcoord");
+	queue->stats.state_changes_unsorted = render_state_changes(keys, count);
+	keys = render_radix_sort(keys, tmp, count);
+	queue->stats.state_changes = render_state_changes(keys, count);
 
-	mesh_bind(mesh, position, normal, texcoord);
+	*out = keys;
+	return count;
 }
 
 static void
-render_bind_camera(struct shader *s, struct camera *c)
+render_bind_shader(struct render_queue *queue, struct shader *shader)
 {
-	GLint proj, view;
+	struct camera *cam = &queue->cam;
+	GLint *loc = shader->uniform;
 
-	proj = glGetUniformLocation(s->prog, "proj");
-	view = glGetUniformLocation(s->prog, "view");
+	/* Set the current shader program to shader->prog */
+	glUseProgram(shader->prog);
+	queue->stats.gl_calls++;
 
-	glUniformMatrix4fv(proj, 1, GL_FALSE, (float *)&c->proj.m);
-	glUniformMatrix4fv(view, 1, GL_FALSE, (float *)&c->view.m);
+	/* uniforms that are constant for the whole frame */
+	if (loc[UNIFORM_PROJ] >= 0) {
+		glUniformMatrix4fv(loc[UNIFORM_PROJ], 1, GL_FALSE, (float *)&cam->proj.m);
+		queue->stats.gl_calls++;
+	}
+	if (loc[UNIFORM_VIEW] >= 0) {
+		glUniformMatrix4fv(loc[UNIFORM_VIEW], 1, GL_FALSE, (float *)&cam->view.m);
+		queue->stats.gl_calls++;
+	}
+	if (loc[UNIFORM_TIME] >= 0) {
+		glUniform1f(loc[UNIFORM_TIME], queue->time);
+		queue->stats.gl_calls++;
+	}
+	if (loc[UNIFORM_CAMP] >= 0) {
+		glUniform3f(loc[UNIFORM_CAMP], cam->position.x, cam->position.y, cam->position.z);
+		queue->stats.gl_calls++;
+	}
+	if (loc[UNIFORM_RESOLUTION] >= 0) {
+		glUniform2f(loc[UNIFORM_RESOLUTION], queue->width, queue->height);
+		queue->stats.gl_calls++;
+	}
 }
 
-static int
-frustum_cull(vec4 frustum[6], struct mesh *mesh, vec3 pos, vec3 scale)
+static void
+render_bind_mesh(struct render_queue *queue, struct mesh *mesh)
 {
-	vec3 center = mesh->bounding.off;
-	float radius = vec3_max(scale) * mesh->bounding.radius;
+	mesh_bind_instanced(mesh, queue->instance_vbo);
+	queue->stats.gl_calls++;
+}
 
-	/* move the sphere center to the object position */
-	pos = vec3_fma(scale, center, pos);
+static void
+render_upload_instances(struct render_queue *queue, uint64_t *keys, size_t count)
+{
+	struct memory_zone mem_state = queue->zone;
+	struct entity *entry = queue->zone.base;
+	struct mesh_instance *instances;
+	struct entity *e;
+	size_t i;
+
+	instances = mempush(&queue->zone, count * sizeof(*instances));
+	for (i = 0; i < count; i++) {
+		e = &entry[keys[i] & RENDER_KEY_INDEX_MASK];
+		instances[i].model = mat4_transform_scale(e->position,
+							  e->rotation,
+							  e->scale);
+		instances[i].color = e->color;
+	}
+
+	/* orphan the previous storage, the buffer stays bound to the VAO */
+	glBindBuffer(GL_ARRAY_BUFFER, queue->instance_vbo);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(*instances), instances, GL_STREAM_DRAW);
+	queue->stats.gl_calls += 2;
+	queue->stats.instances += count;
 
-	return sphere_outside_frustum(frustum, pos, 0.5 * radius);
+	queue->zone = mem_state;
 }
 
 static void
-render_mesh(struct mesh *mesh)
+render_mesh(struct render_queue *queue, struct mesh *mesh, size_t count)
 {
 	if (mesh->index_count > 0)
-		glDrawElements(mesh->primitive, mesh->index_count, GL_UNSIGNED_INT, 0);
+		glDrawElementsInstanced(mesh->primitive, mesh->index_count, mesh->index_type, 0, count);
 	else
-		glDrawArrays(mesh->primitive, 0, mesh->vertex_count);
+		glDrawArraysInstanced(mesh->primitive, 0, mesh->vertex_count, count);
+	queue->stats.gl_calls++;
+	queue->stats.draw_calls++;
+}
+
+/* load what a built queue draws, while no frame is built: the build only
+ * finds the assets, and so does render_queue_exec */
+static void
+render_queue_load(struct render_queue *queue)
+{
+	struct game_asset *game_asset = queue->game_asset;
+	struct entity *entry = queue->zone.base;
+	size_t i;
+
+	for (i = 0; i < queue->count; i++) {
+		if (!game_find_shader(game_asset, entry[i].shader))
+			game_get_shader(game_asset, entry[i].shader);
+		if (!game_find_mesh(game_asset, entry[i].mesh))
+			game_get_mesh(game_asset, entry[i].mesh);
+	}
 }
 
 static void
 render_queue_exec(struct render_queue *queue)
 {
-	struct game_state *game_state = queue->game_state;
 	struct game_asset *game_asset = queue->game_asset;
+	struct memory_zone mem_state = queue->zone;
 	struct entity *entry = queue->zone.base;
-	struct camera *cam = &game_state->cam;
 	int last_mode = 0;
 	enum asset_key last_shader = ASSET_KEY_COUNT;
 	enum asset_key last_mesh = ASSET_KEY_COUNT;
 	struct shader *shader = NULL;
 	struct mesh *mesh = NULL;
-	unsigned int i;
+	uint64_t *keys;
+	size_t i, n, count;
 
 	glDepthMask(GL_TRUE);
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LEQUAL);
 	glEnable(GL_CULL_FACE);
 	glCullFace(GL_BACK);
+	queue->stats.gl_calls += 5;
 
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-	for (i = 0; i < queue->count; i++) {
-		struct entity e = entry[i];
-		if (!game_state->debug && e.type == ENTITY_DEBUG)
-			continue;
+	count = render_queue_sort(queue, &keys);
+	queue->stats.entities = count;
+
+	for (i = 0; i < count; i += n) {
+		struct entity e = entry[keys[i] & RENDER_KEY_INDEX_MASK];
+
+		/* entities sharing the same state are drawn as instances */
+		for (n = 1; i + n < count; n++)
+			if ((keys[i + n] >> RENDER_KEY_STATE_SHIFT) != (keys[i] >> RENDER_KEY_STATE_SHIFT))
+				break;
 
+		/* loaded by render_queue_load, failed loads are not drawn */
 		if (!shader || last_shader != e.shader) {
 			last_shader = e.shader;
-			shader = game_get_shader(game_asset, e.shader);
-			render_bind_shader(shader);
-			render_bind_camera(shader, cam);
+			shader = game_find_shader(game_asset, e.shader);
+			if (!shader)
+				continue;
+			render_bind_shader(queue, shader);
 			mesh = NULL; /* mesh need to be bind again */
 		}
 		if (!mesh || last_mesh != e.mesh) {
 			last_mesh = e.mesh;
-			mesh = game_get_mesh(game_asset, e.mesh);
-			render_bind_mesh(shader, mesh);
+			mesh = game_find_mesh(game_asset, e.mesh);
+			if (!mesh)
+				continue;
+			render_bind_mesh(queue, mesh);
 		}
-		mat4 transform = mat4_transform_scale(e.position,
-						      e.rotation,
-						      e.scale);
-
-		GLint model = glGetUniformLocation(shader->prog, "model");
-		if (model >= 0)
-			glUniformMatrix4fv(model, 1, GL_FALSE, (float *)&transform.m);
-
-		GLint time = glGetUniformLocation(shader->prog, "time");
-		if (time >= 0)
-			glUniform1f(time, game_state->last_time);
-
-		GLint camp = glGetUniformLocation(shader->prog, "camp");
-		if (camp >= 0)
-			glUniform3f(camp, cam->position.x, cam->position.y, cam->position.z);
-
-		GLint color = glGetUniformLocation(shader->prog, "color");
-		if (color >= 0)
-			glUniform3f(color, e.color.x, e.color.y, e.color.z);
-
-		GLint v2res = glGetUniformLocation(shader->prog, "v2Resolution");
-		if (v2res >= 0)
-			glUniform2f(v2res, game_state->input.width, game_state->input.height);
+		render_upload_instances(queue, &keys[i], n);
 
 		if (last_mode != e.mode) {
 			last_mode = e.mode;
@@ -428,10 +634,81 @@ render_queue_exec(struct render_queue *queue)
 		}
 		switch (e.type) {
 		default:
-			render_mesh(mesh);
+			render_mesh(queue, mesh, n);
 			break;
 		}
 	}
+
+	/* drop the sort keys */
+	queue->zone = mem_state;
+}
+
+static void
+render_stats_report(struct frame *frame)
+{
+	struct render_stats *stats = &frame->queue.stats;
+	static const char *names[] = {
+		[GAME_INIT]  = "init",
+		[GAME_MENU]  = "menu",
+		[GAME_PLAY]  = "play",
+		[GAME_PAUSE] = "pause",
+	};
+
+	printf("render %s: %u entities, %u culled, %u draws, %u instances, %u gl calls, "
+	       "%u state changes (%u unsorted)\n",
+	       names[frame->state], stats->entities, stats->culled,
+	       stats->draw_calls, stats->instances, stats->gl_calls,
+	       stats->state_changes, stats->state_changes_unsorted);
+}
+
+static void
+mixer_report(struct game_state *game_state)
+{
+	struct mixer *mixer = &game_state->mixer;
+	double time = mixer->time;
+	size_t frames = mixer->frames;
+	size_t voice_frames = mixer->voice_frames;
+
+	if (frames > game_state->mix_frames)
+		printf("audio: %zu frames mixed, %.1f ns/frame, %.1f ns/frame per voice, "
+		       "%u/%u active voices, %u resampled, %u stolen, %u refused, %u dropped commands\n",
+		       frames - game_state->mix_frames,
+		       (time - game_state->mix_time) * 1e9 / (frames - game_state->mix_frames),
+		       (time - game_state->mix_time) * 1e9 / MAX(1, voice_frames - game_state->mix_voice_frames),
+		       mixer->active_count, mixer->voice_count, mixer->resampled,
+		       mixer->stolen, mixer->refused, mixer->dropped);
+	game_state->mix_time = time;
+	game_state->mix_frames = frames;
+	game_state->mix_voice_frames = voice_frames;
+}
+
+static void
+file_report(struct game_state *game_state)
+{
+	unsigned long calls = game_state->game_asset->file_io->calls();
+
+	printf("file: %lu calls in %u frames, %.1f per frame\n",
+	       calls - game_state->file_calls, game_state->frames,
+	       (double) (calls - game_state->file_calls) / MAX(1, game_state->frames));
+	game_state->file_calls = calls;
+}
+
+static void
+frame_report(struct game_state *game_state)
+{
+	double frames = MAX(1, game_state->frames);
+
+	printf("frames: %u rendered, %u simulation ticks, per frame: build %.2f ms, "
+	       "wait %.2f ms, submit %.2f ms, present %.2f ms\n",
+	       game_state->frames, game_state->ticks,
+	       game_state->build_time * 1000 / frames, game_state->wait_time * 1000 / frames,
+	       game_state->submit_time * 1000 / frames, game_state->present_time * 1000 / frames);
+	game_state->frames = 0;
+	game_state->ticks = 0;
+	game_state->build_time = 0;
+	game_state->wait_time = 0;
+	game_state->submit_time = 0;
+	game_state->present_time = 0;
 }
 
 struct scene {
@@ -439,27 +716,59 @@ struct scene {
 	struct entity *entity;
 };
 
+/* entities culled at once, their bounding spheres fit on the stack */
+#define CULL_BLOCK 256
+
 static void
 render_scene(struct game_state *game_state,
 	     struct game_asset *game_asset,
 	     struct scene *scene,
 	     struct render_queue *rqueue)
 {
-	unsigned int i;
+	float x[CULL_BLOCK], y[CULL_BLOCK], z[CULL_BLOCK], r[CULL_BLOCK];
+	uint32_t visible[CULL_BLOCK / 32];
+	enum asset_key last_mesh = ASSET_KEY_COUNT;
+	struct mesh *mesh = NULL;
+	unsigned int i, n, base;
 	struct camera *cam = &game_state->cam;
 	mat4 vm = mat4_mult_mat4(&cam->proj, &cam->view);
 	vec4 frustum[6];
+	vec3 c;
 
 	mat4_projection_frustum(&vm, frustum);
 
-	for (i = 0; i < scene->count; i++) {
-		struct entity *e = &scene->entity[i];
-		struct mesh *mesh = game_get_mesh(game_asset, e->mesh);
+	for (base = 0; base < scene->count; base += n) {
+		n = MIN(scene->count - base, CULL_BLOCK);
 
-		if (frustum_cull(frustum, mesh, e->position, e->scale))
-			continue;
+		/* world space bounding spheres */
+		for (i = 0; i < n; i++) {
+			struct entity *e = &scene->entity[base + i];
+
+			if (last_mesh != e->mesh) {
+				last_mesh = e->mesh;
+				mesh = game_find_mesh(game_asset, e->mesh);
+			}
+			/* not loaded yet, the GL stage will: never culled */
+			if (!mesh) {
+				x[i] = y[i] = z[i] = 0;
+				r[i] = INFINITY;
+				continue;
+			}
+			c = vec3_fma(e->scale, mesh->bounding.off, e->position);
+			x[i] = c.x;
+			y[i] = c.y;
+			z[i] = c.z;
+			r[i] = 0.5 * vec3_max(e->scale) * mesh->bounding.radius;
+		}
+
+		spheres_in_frustum(frustum, x, y, z, r, n, visible);
 
-		render_queue_push(rqueue, e);
+		for (i = 0; i < n; i++) {
+			if (visible[i / 32] & (1u << (i % 32)))
+				render_queue_push(rqueue, &scene->entity[base + i]);
+			else
+				rqueue->stats.culled++;
+		}
 	}
 }
 
@@ -556,38 +865,36 @@ game_enter_state(struct game_state *game_state, int state)
 		vec3 pos = {    0.38,     2.59,    -1.51};
 		quaternion rot = {{   -0.00,    -0.13,     0.00}, 0.991398};
 		camera_set(&game_state->cam, pos, rot);
-		for (size_t i = 0; i < 4; i++) {
-		sampler_init(&game_state->woosh_sampler[i],
-			     game_state->woosh_wav[i]);
-		}
-		for (size_t i = 0; i < 4; i++) {
-			sampler_init(&game_state->crash_sampler[i],
-				     game_state->crash_wav[i]);
-		}
+		mixer_push_group(&game_state->mixer, MIXER_STOP, AUDIO_SFX, 0);
 	}
-		game_state->window_io->cursor(1); /* show */
+		game_state->cursor = 1; /* show */
 		break;
 	case GAME_PLAY:
 		game_state->player_speed = 1;
 		game_state->player_aim = VEC3_ZERO;
 		game_state->player_pos = VEC3_ZERO;
+		game_state->player_prev_aim = VEC3_ZERO;
+		game_state->player_prev_pos = VEC3_ZERO;
+		game_state->tick_time = 0;
 		game_state->player_dir = QUATERNION_IDENTITY;
 		game_state->round = 0;
 		for (int i = 0; i < 20; i++) {
 			game_state->rocks[i].vld = 0;
 			game_state->rocks[i].pos = VEC3_ZERO;
 		}
-		game_state->window_io->cursor(0); /* hide */
+		game_state->cursor = 0; /* hide */
 		break;
 	default:
 		break;
 	}
+	game_audio_play(game_state, state == GAME_PLAY);
 	game_state->state = state;
 }
 
 static void
-game_menu(struct game_state *game_state, struct input *input, struct render_queue *rqueue)
+game_menu(struct game_state *game_state, struct input *input, struct frame *frame)
 {
+	struct render_queue *rqueue = &frame->queue;
 	float ratio = (double)input->width / (double)input->height;
 	vec3 scale = { 0.25, 0.25 * ratio, 0};
 	vec3 color_default  = {0.7,0.7,0.7};
@@ -656,15 +963,15 @@ game_menu(struct game_state *game_state, struct input *input, struct render_queu
 			game_state->new_state = GAME_PLAY;
 			break;
 		case MENU_SEL_QUIT:
-			game_state->window_io->close();
+			frame->close = 1;
 			break;
 		}
 	}
 	if (game_state->menu_selection != sel) {
-		game_state->menu_sampler.trig_on = 1;
+		mixer_play(&game_state->mixer, WAV_MENU, 1, 0);
 #if 0
 		size_t i = rand()%4;
-		game_state->crash_sampler[i].trig_on = 1;
+		mixer_play(&game_state->mixer, WAV_CRASH_00 + i, 1, 0);
 #endif
 	}
 
@@ -672,8 +979,108 @@ game_menu(struct game_state *game_state, struct input *input, struct render_queu
 
 }
 
+/* one simulation step of dt seconds, see GAME_TICK */
 static void
-game_play(struct game_state *game_state, struct input *input, float dt, struct render_queue *rqueue)
+game_play_tick(struct game_state *game_state, struct input *input, float dt)
+{
+	float wallext = 40; /* as in game_play_render */
+	vec3 pos = game_state->player_pos;
+	vec3 spd = (vec3){0, -250, 0};
+	vec3 inc = vec3_mult(dt, spd);
+	vec3 aim = game_state->player_aim;
+	vec3 aim_inc = { 0 };
+	float aim_spd = 6;
+	struct rock *rocks = game_state->rocks;
+
+	game_state->player_prev_pos = game_state->player_pos;
+	game_state->player_prev_aim = game_state->player_aim;
+
+	if (key_pressed(input, 'A') || key_pressed(input, KEY_LEFT)) {
+		aim_inc.x += dt * aim_spd;
+	}
+	else if (key_pressed(input, 'D') || key_pressed(input, KEY_RIGHT)) {
+		aim_inc.x -= dt * aim_spd;
+	}
+	if (key_pressed(input, 'W') || key_pressed(input, KEY_UP)) {
+		aim_inc.z += dt * aim_spd;
+	}
+	else if (key_pressed(input, 'S') || key_pressed(input, KEY_DOWN)) {
+		aim_inc.z -= dt * aim_spd;
+	}
+	if (aim_inc.x != 0 || aim_inc.z != 0)
+		aim_inc = vec3_normalize(aim_inc);
+	/* the damping and steering were tuned per frame at 60 fps */
+	aim = vec3_mult(powf(0.9, dt * 60), aim);
+	aim = vec3_add(aim, vec3_mult(dt * aim_spd, aim_inc));
+	aim.y = 0;
+
+	pos = vec3_add(pos, vec3_mult(game_state->player_speed * dt * 60, aim));
+	float posy = pos.y;
+	pos.y = 0;
+	float wall_radius = 25;
+	if (vec3_norm(pos) > wall_radius)
+		pos = vec3_mult(wall_radius, vec3_normalize(pos));
+
+	pos.y = posy + inc.y;
+
+	for (int i = 0; i < 10; i++) {
+		if (!rocks[i].vld)
+			continue;
+		/* rock position -> player pos */
+		vec3 r2p = vec3_sub(pos, rocks[i].pos);
+		/* rock extent */
+		vec3 rdir = quaternion_rotate(rocks[i].dir, VEC3_AXIS_Y);
+		float lbda = vec3_dot(r2p, rdir);
+		vec3 dis = vec3_mult(lbda, rdir);
+		float d = vec3_norm(vec3_sub(r2p, dis));
+
+		if (lbda < 25 && d < 6) {
+			/* dead */
+			mixer_play(&game_state->mixer, WAV_CRASH_00, 1, 0);
+			game_state->new_state = GAME_MENU;
+		} else if (lbda < 30 && d < 10) {
+			/* trigg sound */
+			if (rocks[i].trg == 0) {
+				size_t sampler_id = rand() % 4;
+				mixer_play(&game_state->mixer,
+					   WAV_WOOSH_00 + sampler_id, 1, 0);
+				rocks[i].trg = 1;
+			}
+		}
+	}
+
+	/* wrap position */
+	if (pos.y < 0) {
+		int lvl = MIN(game_state->round, 10);
+		pos.y = wallext * 10;
+		game_state->round++;
+		for (int i = 1; i < lvl; i++) {
+			float rr = wall_radius + 5;
+			float a = 2 * M_PI * rand() / (float) RAND_MAX;
+			float x = rr * sin(a);
+			float z = rr * cos(a);
+			vec3 rpos = {x, wallext * i, z};
+			vec3 ldir = rpos;//{0, rpos.y, 0};
+			quaternion rdir = quaternion_look_at(ldir, VEC3_AXIS_Y);
+			rpos.y = wallext * i;
+			rocks[i] = rocks[i + 10];
+			rocks[i + 10].vld = 1;
+			rocks[i + 10].trg = 0;
+			rocks[i + 10].pos = rpos;
+			rocks[i + 10].dir = rdir;
+		}
+		/* do not interpolate across the wrap, only this tick's fall */
+		game_state->player_prev_pos = pos;
+		game_state->player_prev_pos.y -= inc.y;
+	}
+	game_state->player_pos = pos;
+	game_state->player_aim = aim;
+}
+
+/* draw the player and the camera alpha of the way from the previous tick
+ * to the current one */
+static void
+game_play_render(struct game_state *game_state, float alpha, struct render_queue *rqueue)
 {
 	struct game_asset *game_asset = game_state->game_asset;
 	vec3 wall_scale = (vec3){1, 1, 1};
@@ -727,41 +1134,10 @@ game_play(struct game_state *game_state, struct input *input, float dt, struct r
 	};
 	vec3 cap = {0, wallext * 10, 0};
 	vec3 cam;
-	vec3 pos = game_state->player_pos;
-	vec3 spd = (vec3){0, -250, 0};
-	vec3 inc = vec3_mult(dt, spd);
-	vec3 aim = game_state->player_aim;
-	vec3 aim_inc = { 0 };
-	float aim_spd = 6;
+	vec3 pos = vec3_lerp(game_state->player_prev_pos, game_state->player_pos, alpha);
+	vec3 aim = vec3_lerp(game_state->player_prev_aim, game_state->player_aim, alpha);
 	struct rock *rocks = game_state->rocks;
 
-	if (key_pressed(input, 'A') || key_pressed(input, KEY_LEFT)) {
-		aim_inc.x += dt * aim_spd;
-	}
-	else if (key_pressed(input, 'D') || key_pressed(input, KEY_RIGHT)) {
-		aim_inc.x -= dt * aim_spd;
-	}
-	if (key_pressed(input, 'W') || key_pressed(input, KEY_UP)) {
-		aim_inc.z += dt * aim_spd;
-	}
-	else if (key_pressed(input, 'S') || key_pressed(input, KEY_DOWN)) {
-		aim_inc.z -= dt * aim_spd;
-	}
-	if (aim_inc.x != 0 || aim_inc.z != 0)
-		aim_inc = vec3_normalize(aim_inc);
-	aim = vec3_mult(0.9, aim);
-	aim = vec3_add(aim, vec3_mult(dt * aim_spd, aim_inc));
-	aim.y = 0;
-
-	pos = vec3_add(pos, vec3_mult(game_state->player_speed, aim));
-	float posy = pos.y;
-	pos.y = 0;
-	float wall_radius = 25;
-	if (vec3_norm(pos) > wall_radius)
-		pos = vec3_mult(wall_radius, vec3_normalize(pos));
-
-	pos.y = posy + inc.y;
-
 	vec3 cam_look = vec3_add(pos, vec3_mult(0.2, aim));
 	cam_look.y = pos.y - 5;
 
@@ -796,19 +1172,6 @@ game_play(struct game_state *game_state, struct input *input, float dt, struct r
 		vec3 dis = vec3_mult(lbda, rdir);
 		float d = vec3_norm(vec3_sub(r2p, dis));
 
-		if (lbda < 25 && d < 6) {
-			/* dead */
-			game_state->crash_sampler[0].trig_on = 1;
-			game_state->new_state = GAME_MENU;
-		} else if (lbda < 30 && d < 10) {
-			/* trigg sound */
-			if (rocks[i].trg == 0) {
-				size_t sampler_id = rand() % 4;
-				game_state->woosh_sampler[sampler_id].trig_on = 1;
-				rocks[i].trg = 1;
-			}
-		}
-
 		if (lbda < 25) {
 			/* in cylindre segment */
 			render_queue_push(rqueue, &(struct entity){
@@ -879,48 +1242,30 @@ game_play(struct game_state *game_state, struct input *input, float dt, struct r
 			.rotation = QUATERNION_IDENTITY,
 			.color = {1,0,0},
 		});
-
-	/* wrap position */
-	if (pos.y < 0) {
-		int lvl = MIN(game_state->round, 10);
-		pos.y = wallext * 10;
-		game_state->round++;
-		for (int i = 1; i < lvl; i++) {
-			float rr = wall_radius + 5;
-			float a = 2 * M_PI * rand() / (float) RAND_MAX;
-			float x = rr * sin(a);
-			float z = rr * cos(a);
-			vec3 rpos = {x, wallext * i, z};
-			vec3 ldir = rpos;//{0, rpos.y, 0};
-			quaternion rdir = quaternion_look_at(ldir, VEC3_AXIS_Y);
-			rpos.y = wallext * i;
-			rocks[i] = rocks[i + 10];
-			rocks[i + 10].vld = 1;
-			rocks[i + 10].trg = 0;
-			rocks[i + 10].pos = rpos;
-			rocks[i + 10].dir = rdir;
-		}
-	}
-	game_state->player_pos = pos;
-	game_state->player_aim = aim;
 }
 
-void
-game_step(struct game_memory *memory, struct input *input, struct audio *audio)
+/* Build stage, run by the frame job: step the game and record what to
+ * draw in a frame, without any GL call. It owns the game state until the
+ * GL stage waits for it. */
+static void
+game_build(struct job_worker *worker, void *arg)
 {
-	struct game_state *game_state = memory->state.base;
-	struct game_asset *game_asset = memory->asset.base;
-	struct render_queue rqueue;
+	struct game_state *game_state = arg;
+	struct game_asset *game_asset = game_state->game_asset;
+	struct input *input = &game_state->frame_input;
+	struct frame *frame = &game_state->frame[game_state->frame_count & 1];
+	struct render_queue *rqueue = &frame->queue;
 	float dt = input->time - game_state->last_time;
-	game_state->last_time = input->time;
+	double start = job_time();
+	int ticks = 0;
+	(void) worker;
 
-	memory->scrap.used = 0;
-	render_queue_init(&rqueue, game_state, game_asset,
-			  mempush(&memory->scrap, SZ_4M), SZ_4M);
+	game_state->last_time = input->time;
+	render_queue_init(rqueue, game_asset, rqueue->zone.base, rqueue->zone.size);
+	frame->close = 0;
 
 	if (game_state->input.width != input->width ||
 	    game_state->input.height != input->height) {
-		glViewport(0, 0, input->width, input->height);
 		camera_set_ratio(&game_state->cam, (float)input->width / (float)input->height);
 		game_state->input.width = input->width;
 		game_state->input.height = input->height;
@@ -932,7 +1277,7 @@ game_step(struct game_memory *memory, struct input *input, struct audio *audio)
 	game_state->key_debug = key_pressed(input, 'X');
 	if (key_pressed(input, 'Z') && !game_state->key_flycam) {
 		game_state->flycam = !game_state->flycam;
-		game_state->window_io->cursor(!game_state->flycam);
+		game_state->cursor = !game_state->flycam;
 	}
 	game_state->key_flycam = key_pressed(input, 'Z');
 
@@ -941,46 +1286,106 @@ game_step(struct game_memory *memory, struct input *input, struct audio *audio)
 
 	switch (game_state->state) {
 	case GAME_MENU:
-		game_menu(game_state, input, &rqueue);
+		game_menu(game_state, input, frame);
 		break;
 	case GAME_PLAY:
-		game_play(game_state, input, dt, &rqueue);
+		/* a late frame catches up, up to GAME_MAX_TICKS */
+		game_state->tick_time = MIN(game_state->tick_time + dt, GAME_MAX_TICKS * GAME_TICK);
+		for (; game_state->tick_time >= GAME_TICK; ticks++) {
+			game_state->tick_time -= GAME_TICK;
+			game_play_tick(game_state, input, GAME_TICK);
+			if (game_state->new_state != GAME_PLAY)
+				break;
+		}
+		game_play_render(game_state, game_state->tick_time / GAME_TICK, rqueue);
 		break;
 	default:
 		break;
 	}
 	if (game_state->debug)
-		debug_origin_mark(&rqueue);
+		debug_origin_mark(rqueue);
 	if (game_state->flycam)
 		flycam_move(game_state, input, dt);
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	render_queue_exec(&rqueue);
+	render_queue_close(rqueue, game_state);
+	frame->state = game_state->state;
+	frame->cursor = game_state->cursor;
+	frame->ticks = ticks;
+	frame->build_time = job_time() - start;
+}
 
-	/* audio */
-	float sample_l, sample_r;
-	float volume = 0.2;
-	for (int i = 0; i < audio->size; i++) {
-		if (game_state->state == GAME_PLAY) {
-			sample_l = step_sampler(&game_state->wind_sampler);
-			sample_r = step_sampler(&game_state->wind_sampler);
-			for (size_t i = 0; i<4; i++) {
-				sample_l += step_sampler(&game_state->woosh_sampler[i]);
-				sample_r += step_sampler(&game_state->woosh_sampler[i]);
-				sample_l += step_sampler(&game_state->crash_sampler[i]);
-				sample_r += step_sampler(&game_state->crash_sampler[i]);
-			}
-		} else {
-			sample_l = step_sampler(&game_state->theme_sampler);
-			sample_r = step_sampler(&game_state->theme_sampler);
-			sample_l += step_sampler(&game_state->casey_sampler);
-			sample_r += step_sampler(&game_state->casey_sampler);
-			sample_l += step_sampler(&game_state->menu_sampler);
-			sample_r += step_sampler(&game_state->menu_sampler);
-		}
-		audio->buffer[i].r = volume * sample_r;
-		audio->buffer[i].l = volume * sample_l;
-	}
+/* GL stage, on the platform thread. Frame N+1 is built by the frame job
+ * while frame N is submitted and presented: what is drawn lags the input
+ * by a frame. */
+void
+game_step(struct game_memory *memory, struct input *input)
+{
+	struct game_state *game_state = memory->state.base;
+	struct game_asset *game_asset = memory->asset.base;
+	struct render_queue *rqueue;
+	struct frame *frame;
+	double start = job_time();
 
+	/* the frame started by the last step is built, nothing else runs */
+	job_wait(memory->jobs);
+	game_state->wait_time += job_time() - start;
+	if (game_state->frame_end > 0)
+		game_state->present_time += start - game_state->frame_end;
+
+	/* reloads need the GL context, and must not happen under the build */
 	game_asset_poll(game_asset);
+	if (game_state->frame_count > 0)
+		render_queue_load(&game_state->frame[game_state->frame_count & 1].queue);
+
+	game_state->frame_input = *input;
+	game_state->frame_count++;
+	job_push(memory->jobs, game_build, game_state);
+
+	start = job_time();
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (game_state->frame_count < 2) {
+		game_state->frame_end = job_time();
+		return; /* nothing built yet */
+	}
+	frame = &game_state->frame[(game_state->frame_count - 1) & 1];
+	rqueue = &frame->queue;
+
+	if (game_state->viewport_width != rqueue->width ||
+	    game_state->viewport_height != rqueue->height) {
+		glViewport(0, 0, rqueue->width, rqueue->height);
+		game_state->viewport_width = rqueue->width;
+		game_state->viewport_height = rqueue->height;
+	}
+	if (game_state->cursor_shown != frame->cursor) {
+		game_state->window_io->cursor(frame->cursor);
+		game_state->cursor_shown = frame->cursor;
+	}
+	if (frame->close)
+		game_state->window_io->close();
+
+	rqueue->stats.gl_calls++;
+	render_queue_exec(rqueue);
+
+	game_state->submit_time += job_time() - start;
+	game_state->build_time += frame->build_time;
+	game_state->ticks += frame->ticks;
+	game_state->frames++;
+
+	/* dump render counters once per second while debugging */
+	if (rqueue->debug && input->time - game_state->last_report >= 1.0) {
+		render_stats_report(frame);
+		mixer_report(game_state);
+		file_report(game_state);
+		frame_report(game_state);
+		game_state->last_report = input->time;
+	}
+	game_state->frame_end = job_time();
+}
+
+void
+game_audio(struct game_memory *memory, struct audio *audio)
+{
+	struct game_state *game_state = memory->state.base;
+
+	mixer_render(&game_state->mixer, audio);
 }
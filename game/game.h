@@ -7,12 +7,24 @@
 
 typedef int64_t (file_size_t)(const char *path);
 typedef int64_t (file_read_t)(const char *path, void *buf, size_t size);
+typedef int64_t (file_write_t)(const char *path, const void *buf, size_t size);
+typedef void *(file_map_t)(const char *path, size_t *size);
+typedef void (file_unmap_t)(void *addr, size_t size);
 typedef time_t (file_time_t)(const char *path);
+typedef int (file_watch_t)(const char *path);
+typedef const char *(file_changed_t)(void);
+typedef unsigned long (file_calls_t)(void);
 
 struct file_io {
 	file_size_t *size;
 	file_read_t *read;
+	file_write_t *write;
+	file_map_t *map;     /* may return NULL, then use read */
+	file_unmap_t *unmap;
 	file_time_t *time;
+	file_watch_t *watch; /* return -1 if path is not watched, then poll */
+	file_changed_t *changed; /* next watched path changed, NULL if none */
+	file_calls_t *calls; /* file system calls made so far */
 };
 
 typedef void (window_close_t)(void);
@@ -27,15 +39,23 @@ struct game_memory {
 	struct memory_zone asset;
 	struct memory_zone scrap;
 	struct memory_zone audio;
+	/* runs the frame job, owned by the platform so that its thread
+	 * outlives the game library reloads */
+	struct job_pool *jobs;
 };
 
 /* typedef for function type */
 typedef void (game_init_t)(struct game_memory *memory, struct file_io *file_io, struct window_io *win_io);
-typedef void (game_step_t)(struct game_memory *memory, struct input *input, struct audio *audio);
+typedef void (game_step_t)(struct game_memory *memory, struct input *input);
+/* called from the audio thread, fill audio with the game mix */
+typedef void (game_audio_t)(struct game_memory *memory, struct audio *audio);
 typedef void (game_fini_t)(struct game_memory *memory);
+typedef int (game_bake_t)(struct game_memory *memory, struct file_io *file_io, const char *path);
 
 /* declare functions signature */
 game_init_t game_init;
 game_step_t game_step;
+game_audio_t game_audio;
 game_fini_t game_fini;
+game_bake_t game_bake;
 #endif
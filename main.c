@@ -9,6 +9,9 @@
 
 #ifdef CONFIG_DYNAMIC_RELOAD
 #include <dlfcn.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 #endif
 
 #include "plat/glad.h"
@@ -51,7 +54,13 @@ rate_limit(double rate)
 struct file_io file_io = {
 	.size = file_size,
 	.read = file_read,
+	.write = file_write,
+	.map = file_map,
+	.unmap = file_unmap,
 	.time = file_time,
+	.watch = file_watch,
+	.changed = file_changed,
+	.calls = file_calls,
 };
 
 SDL_Window *window;
@@ -59,19 +68,20 @@ SDL_GLContext context;
 unsigned int width = 1080;
 unsigned int height = 800;
 int should_close;
+int frame_rate; /* 0 when vsync paces the frames */
 int focused;
 int show_cursor;
 static int xpre, ypre;
 
 struct input game_input_next;
 struct input game_input;
-struct audio game_audio;
 struct game_memory game_memory;
 
 struct audio_config audio_config = {
 	.samplerate = 48000,
 	.channels = 2,
 	.format = AUDIO_FORMAT_F32,
+	.latency = 0.050,
 };
 
 struct audio_state audio_state;
@@ -81,7 +91,9 @@ struct libgame {
 	time_t time;
 	game_init_t *init;
 	game_step_t *step;
+	game_audio_t *audio;
 	game_fini_t *fini;
+	game_bake_t *bake;
 };
 
 static void
@@ -135,7 +147,6 @@ window_init(char *name)
 	SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
 
 	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, SDL_TRUE);
-	SDL_GL_SetSwapInterval(1);
 
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
@@ -155,6 +166,17 @@ window_init(char *name)
 	if (!context)
 		die("Failed to create openGL context: %s\n", SDL_GetError());
 
+	/* render once per refresh: wait for vsync, or else sleep until the
+	 * next one is due */
+	if (SDL_GL_SetSwapInterval(1)) {
+		SDL_DisplayMode mode;
+		if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 &&
+		    mode.refresh_rate > 0)
+			frame_rate = mode.refresh_rate;
+		else
+			frame_rate = 60;
+	}
+
 	show_cursor = 1;
 	SDL_SetRelativeMouseMode(show_cursor ? SDL_FALSE : SDL_TRUE);
 
@@ -328,53 +350,163 @@ window_poll_events(void)
 struct libgame libgame = {
 	.init = game_init,
 	.step = game_step,
+	.audio = game_audio,
 	.fini = game_fini,
+	.bake = game_bake,
 };
 
-static void
-libgame_reload(void)
-{
 #ifdef CONFIG_DYNAMIC_RELOAD
-	time_t time;
-	int ret;
+#define LIBGAME_POLL 0.25 /* seconds */
+
+/* A thread watches libgame.so and loads each new build in the background,
+ * the main thread only swaps the function pointers between two frames.
+ * Every build is loaded from its own copy: dlopen returns the handle
+ * already open for a path, and the linker may still be writing libgame.so
+ * while the old code runs. */
+static struct {
+	struct libgame next;
+	atomic_int ready; /* next is loaded, until the main thread swaps it */
+	void *old; /* handle swapped out, closed by the thread */
+	time_t time, seen; /* thread side, loaded and last read */
+	unsigned int version;
+	double load_time;
+} reload;
 
-	libgame.init = NULL;
-	libgame.step = NULL;
-	libgame.fini = NULL;
-
-	if (libgame.handle) {
-		ret = dlclose(libgame.handle);
-		if (ret)
-			fprintf(stderr, "dlclose failed\n");
+static int
+libgame_open(struct libgame *lib, unsigned int version)
+{
+	char path[256];
+	int64_t size;
+	void *buf;
+
+	/* with a slash, dlopen does not search the library path */
+	snprintf(path, sizeof(path), "%s%slibgame.%u.so",
+		 strchr(CONFIG_LIBDIR, '/') ? "" : "./", CONFIG_LIBDIR, version);
+
+	size = file_size(CONFIG_LIBDIR"libgame.so");
+	if (size <= 0 || !(buf = malloc(size)))
+		return -1;
+	if (file_read(CONFIG_LIBDIR"libgame.so", buf, size) != size ||
+	    file_write(path, buf, size) != size) {
+		free(buf);
+		return -1;
 	}
-
-	time = file_time(CONFIG_LIBDIR"libgame.so");
+	free(buf);
 
 	/* clear previous error message  */
 	dlerror();
 
-	libgame.handle = dlopen("libgame.so", RTLD_NOW);
+	lib->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	/* the mapping outlives the file */
+	unlink(path);
+	if (!lib->handle) {
+		fprintf(stderr, "libgame: %s\n", dlerror());
+		return -1;
+	}
 
-	if (libgame.handle) {
-		libgame.init = dlsym(libgame.handle, "game_init");
-		libgame.step = dlsym(libgame.handle, "game_step");
-		libgame.fini = dlsym(libgame.handle, "game_fini");
-		libgame.time = time;
+	lib->init = dlsym(lib->handle, "game_init");
+	lib->step = dlsym(lib->handle, "game_step");
+	lib->audio = dlsym(lib->handle, "game_audio");
+	lib->fini = dlsym(lib->handle, "game_fini");
+	lib->bake = dlsym(lib->handle, "game_bake");
+
+	return 0;
+}
+
+static void *
+libgame_watch(void *arg)
+{
+	struct timespec ts = { 0, LIBGAME_POLL * 1e9 };
+	struct libgame *next = &reload.next;
+	double start;
+	time_t time;
+	UNUSED(arg);
+
+	for (;;) {
+		nanosleep(&ts, NULL);
+		if (atomic_load_explicit(&reload.ready, memory_order_acquire))
+			continue;
+		if (reload.old) {
+			dlclose(reload.old);
+			reload.old = NULL;
+		}
+
+		/* wait for the linker to be done, the time must hold for a poll */
+		time = file_time(CONFIG_LIBDIR"libgame.so");
+		if (time == reload.time || time != reload.seen) {
+			reload.seen = time;
+			continue;
+		}
+		reload.time = time; /* a broken build is not tried again */
+
+		start = job_time();
+		if (libgame_open(next, ++reload.version) == 0) {
+			next->time = time;
+			reload.load_time = job_time() - start;
+			atomic_store_explicit(&reload.ready, 1, memory_order_release);
+		}
 	}
+
+	return NULL;
+}
+#endif
+
+/* first load, blocking */
+static void
+libgame_load(void)
+{
+#ifdef CONFIG_DYNAMIC_RELOAD
+	libgame.init = NULL;
+	libgame.step = NULL;
+	libgame.audio = NULL;
+	libgame.fini = NULL;
+	libgame.bake = NULL;
+
+	libgame.time = file_time(CONFIG_LIBDIR"libgame.so");
+	libgame_open(&libgame, 0);
 #endif
 }
 
-static int
-libgame_changed(void)
+static void
+libgame_watch_start(void)
 {
 #ifdef CONFIG_DYNAMIC_RELOAD
-	time_t new_time;
+	pthread_t thread;
+
+	reload.time = reload.seen = libgame.time;
+	atomic_init(&reload.ready, 0);
+	if (pthread_create(&thread, NULL, libgame_watch, NULL) == 0)
+		pthread_detach(thread);
+	else
+		fprintf(stderr, "libgame: no reload thread\n");
+#endif
+}
+
+/* between two frames, switch to the library loaded in the background */
+static void
+libgame_swap(void)
+{
+#ifdef CONFIG_DYNAMIC_RELOAD
+	double start;
+	void *old;
+
+	if (!atomic_load_explicit(&reload.ready, memory_order_acquire))
+		return;
 
-	new_time = file_time(CONFIG_LIBDIR"libgame.so");
+	start = job_time();
+	/* so do the frame job and the audio thread, keep them out */
+	job_wait(game_memory.jobs);
+	audio_lock(&audio_state);
+	old = libgame.handle;
+	libgame = reload.next;
+	audio_unlock(&audio_state);
 
-	return libgame.time < new_time;
+	printf("libgame: version %u loaded in %.1f ms, swapped in %.3f ms\n",
+	       reload.version, reload.load_time * 1000.0, (job_time() - start) * 1000.0);
+
+	reload.old = old;
+	atomic_store_explicit(&reload.ready, 0, memory_order_release);
 #endif
-	return 0;
 }
 
 static struct memory_zone
@@ -389,31 +521,52 @@ alloc_memory_zone(void *base, size_t align, size_t size)
 	return zone;
 }
 
+/* one worker builds the next frame while the main thread draws */
+static void
+alloc_frame_jobs(struct game_memory *memory)
+{
+	static struct job_pool pool;
+	struct memory_zone zone = alloc_memory_zone(NULL, SZ_1M, SZ_1M);
+
+	job_pool_init(&pool, &zone, 1);
+	memory->jobs = &pool;
+}
+
 static void
 alloc_game_memory(struct game_memory *memory)
 {
 	memory->state = alloc_memory_zone(NULL, SZ_4M, SZ_16M);
-	memory->scrap = alloc_memory_zone(NULL, SZ_4M, SZ_16M);
+	/* the asset preload runs a worker per cpu in it, see job_pool_init */
+	memory->scrap = alloc_memory_zone(NULL, SZ_4M,
+		MAX(SZ_32M, (MIN(job_cpu_count(), JOB_MAX_THREADS) + 1) * JOB_MIN_SCRATCH + SZ_4M));
 	memory->asset = alloc_memory_zone(NULL, SZ_4M, SZ_16M);
 	memory->audio = alloc_memory_zone(NULL, SZ_4M, SZ_16M);
 }
 
+/* called from the audio thread, with the audio lock held */
+static void
+audio_render(void *data, void *buffer, size_t frames)
+{
+	struct audio audio = {
+		.size = frames,
+		.buffer = buffer,
+		.samplerate = audio_state.config.samplerate,
+	};
+
+	if (libgame.audio)
+		libgame.audio(data, &audio);
+	else
+		memset(buffer, 0, frames * sizeof(struct sample));
+}
+
 static void
 main_loop_step(void)
 {
 	window_poll_events();
 
-	/* get an audio buffer */
-	game_audio.size   = ring_buffer_write_size(&audio_state.buffer);
-	game_audio.buffer = ring_buffer_write_addr(&audio_state.buffer);
-
 	swap_input(&game_input, &game_input_next);
 	if (libgame.step)
-		libgame.step(&game_memory, &game_input, &game_audio);
-
-	/* finalize audio write */
-	ring_buffer_write_done(&audio_state.buffer, game_audio.size);
-	audio_step(&audio_state);
+		libgame.step(&game_memory, &game_input);
 
 	window_swap_buffers();
 }
@@ -424,6 +577,24 @@ void emscripten_set_main_loop(void (* f)(), int, int);
 	{ emscripten_set_main_loop(main_loop_step, 0, 10); return 0; } while (0)
 #endif
 
+static int
+bake(int argc, char **argv)
+{
+	int i, ret = 0;
+
+	alloc_game_memory(&game_memory);
+	libgame_load();
+
+	if (!libgame.bake)
+		die("bake: game library not loaded\n");
+
+	for (i = 0; i < argc; i++)
+		if (libgame.bake(&game_memory, &file_io, argv[i]))
+			ret = 1;
+
+	return ret;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -431,10 +602,19 @@ main(int argc, char **argv)
 		printf("version %s\n", VERSION);
 		return 0;
 	}
+	if (argc >= 2 && strcmp(argv[1], "-bake") == 0)
+		return bake(argc - 2, argv + 2);
+	if (argc >= 3 && strcmp(argv[1], "-audio") == 0) {
+		audio_config.backend = argv[2];
+		if (argc >= 4)
+			audio_config.output = argv[3];
+	}
 
 	alloc_game_memory(&game_memory);
+	alloc_frame_jobs(&game_memory);
 
-	libgame_reload();
+	libgame_load();
+	libgame_watch_start();
 
 	window_init(argv[0]);
 
@@ -442,21 +622,24 @@ main(int argc, char **argv)
 		libgame.init(&game_memory, &file_io, &glfw_io);
 
 	audio_state = audio_create(audio_config);
+	audio_set_render(&audio_state, audio_render, &game_memory);
 	audio_init(&audio_state);
 
 	while (!window_should_close()) {
-		if (libgame_changed())
-			libgame_reload();
+		libgame_swap();
 		main_loop_step();
-		rate_limit(300);
+		if (frame_rate)
+			rate_limit(frame_rate);
 	}
 
+	/* stop the frame job and the audio thread before the game goes away */
+	job_pool_fini(game_memory.jobs);
+	audio_fini(&audio_state);
+
 	if (libgame.fini)
 		libgame.fini(&game_memory);
 
 	window_fini();
 
-	audio_fini(&audio_state);
-
 	return 0;
 }
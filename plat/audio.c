@@ -1,8 +1,32 @@
 #include <stddef.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include "core.h"
 #include "audio.h"
 
+/* frames a device playing since the last call would have consumed */
+static size_t
+clock_frames(struct audio_state *audio, struct timespec *last)
+{
+	struct timespec now;
+	size_t count;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (last->tv_sec == 0)
+		*last = now;
+
+	count = audio->config.samplerate * ((now.tv_sec - last->tv_sec) +
+					    (now.tv_nsec - last->tv_nsec) / 1e9);
+	count = MIN(count, ring_buffer_fill_count(&audio->buffer));
+	if (count > 0)
+		*last = now;
+
+	return count;
+}
+
 void
 dummy_init(struct audio_state *audio)
 {
@@ -18,16 +42,129 @@ dummy_fini(struct audio_state *audio)
 void
 dummy_step(struct audio_state *audio)
 {
-	size_t count = ring_buffer_read_size(&audio->buffer);
-	ring_buffer_read_done(&audio->buffer, count);
+	/* no device, drop the frames at the pace one would play them */
+	static struct timespec last;
+
+	ring_buffer_read_done(&audio->buffer, clock_frames(audio, &last));
 }
 
 struct audio_io *dummy_io = &(struct audio_io){
+	.name = "dummy",
 	.init = dummy_init,
 	.fini = dummy_fini,
 	.step = dummy_step,
 };
 
+/* null: drop the frames as soon as they are mixed, to measure the mixer
+ * throughput */
+void
+null_step(struct audio_state *audio)
+{
+	ring_buffer_read_done(&audio->buffer, ring_buffer_fill_count(&audio->buffer));
+}
+
+struct audio_io *null_io = &(struct audio_io){
+	.name = "null",
+	.offline = 1,
+	.init = dummy_init,
+	.fini = dummy_fini,
+	.step = null_step,
+};
+
+/* file: write the frames to a wav file, consumed at the pace a device
+ * would play them */
+struct wav_file {
+	FILE *f;
+	struct timespec last;
+	unsigned long frames;
+};
+
+static unsigned char *
+put_le(unsigned char *p, uint32_t v, int n)
+{
+	while (n--) {
+		*p++ = v & 0xff;
+		v >>= 8;
+	}
+	return p;
+}
+
+/* RIFF wave header, rewritten at the end once the size is known */
+static void
+wav_file_header(struct audio_state *audio, struct wav_file *wav)
+{
+	unsigned char h[44], *p = h;
+	uint32_t frame = audio->buffer.size;
+	uint32_t datasize = wav->frames * frame;
+	int format = audio->config.format == AUDIO_FORMAT_F32 ? 3 : 1;
+
+	memcpy(p, "RIFF", 4); p += 4;
+	p = put_le(p, sizeof(h) - 8 + datasize, 4);
+	memcpy(p, "WAVEfmt ", 8); p += 8;
+	p = put_le(p, 16, 4);
+	p = put_le(p, format, 2);
+	p = put_le(p, audio->config.channels, 2);
+	p = put_le(p, audio->config.samplerate, 4);
+	p = put_le(p, audio->config.samplerate * frame, 4);
+	p = put_le(p, frame, 2);
+	p = put_le(p, 8 * frame / audio->config.channels, 2);
+	memcpy(p, "data", 4); p += 4;
+	p = put_le(p, datasize, 4);
+
+	fseek(wav->f, 0, SEEK_SET);
+	fwrite(h, sizeof(h), 1, wav->f);
+	fseek(wav->f, 0, SEEK_END);
+}
+
+void
+file_init(struct audio_state *audio)
+{
+	static struct wav_file wav;
+	const char *path = audio->config.output ? audio->config.output : "audio.wav";
+
+	wav.f = fopen(path, "wb");
+	if (!wav.f)
+		die("audio: %s: %s\n", path, strerror(errno));
+	wav.frames = 0;
+	wav_file_header(audio, &wav);
+	audio->priv = &wav;
+}
+
+void
+file_fini(struct audio_state *audio)
+{
+	struct wav_file *wav = audio->priv;
+
+	/* now that the size is known */
+	wav_file_header(audio, wav);
+	fclose(wav->f);
+	printf("audio file: %lu frames written, %.1f s\n", wav->frames,
+	       wav->frames / (double) audio->config.samplerate);
+}
+
+void
+file_step(struct audio_state *audio)
+{
+	struct wav_file *wav = audio->priv;
+	size_t count = clock_frames(audio, &wav->last);
+	size_t n;
+
+	while (count > 0) {
+		n = MIN(count, ring_buffer_read_size(&audio->buffer));
+		fwrite(ring_buffer_read_addr(&audio->buffer), audio->buffer.size, n, wav->f);
+		ring_buffer_read_done(&audio->buffer, n);
+		wav->frames += n;
+		count -= n;
+	}
+}
+
+struct audio_io *file_audio_io = &(struct audio_io){
+	.name = "file",
+	.init = file_init,
+	.fini = file_fini,
+	.step = file_step,
+};
+
 #ifdef CONFIG_JACK
 extern struct audio_io *jack_io;
 #else
@@ -75,37 +212,109 @@ audio_create(struct audio_config config)
 	struct audio_state audio = { .config = config };
 	size_t frame = config.channels * frame_size(config.format);
 	size_t count = 8 * 512;
-	void *data = xvmalloc(NULL, 0, count * frame);
+	void *data;
 
-	audio.buffer = ring_buffer_init(data, count, frame);
+	/* mirrored, the backends and the mixer never see the wrap */
+	data = xvmirror(count * frame);
+	if (data) {
+		ring_buffer_init_mirrored(&audio.buffer, data, count, frame);
+	} else {
+		data = xvmalloc(NULL, 0, count * frame);
+		ring_buffer_init(&audio.buffer, data, count, frame);
+	}
 
 	return audio;
 }
 
+static void *
+audio_thread(void *arg)
+{
+	struct audio_state *audio = arg;
+	struct ring_buffer *ring = &audio->buffer;
+	struct timespec ts;
+	struct timespec t0, t1;
+	void *addr;
+
+	/* wake up twice per block */
+	ts.tv_sec = 0;
+	ts.tv_nsec = 1000000000.0 * AUDIO_BLOCK_SIZE / audio->config.samplerate / 2;
+
+	while (!audio->quit) {
+		pthread_mutex_lock(&audio->lock);
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		/* a block is never split by the end of the ring: either the
+		 * ring is mirrored, or its size is a multiple of the block and
+		 * so is the write position */
+		while (ring_buffer_write_size(ring) >= AUDIO_BLOCK_SIZE) {
+			addr = ring_buffer_write_addr(ring);
+			if (audio->render)
+				audio->render(audio->data, addr, AUDIO_BLOCK_SIZE);
+			else
+				memset(addr, 0, AUDIO_BLOCK_SIZE * ring->size);
+			ring_buffer_write_done(ring, AUDIO_BLOCK_SIZE);
+			audio->frames += AUDIO_BLOCK_SIZE;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		pthread_mutex_unlock(&audio->lock);
+		audio->render_time += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+		audio_step(audio);
+		if (!audio_io->offline)
+			nanosleep(&ts, NULL);
+	}
+
+	return NULL;
+}
+
 void
 audio_init(struct audio_state *audio)
 {
-	/* grab the first available audio backend */
-	if (!audio_io && jack_io)
-		audio_io = jack_io;
-	if (!audio_io && pulse_io)
-		audio_io = pulse_io;
-	if (!audio_io && miniaudio_io)
-		audio_io = miniaudio_io;
-	if (!audio_io && sdl_audio_io)
-		audio_io = sdl_audio_io;
+	struct audio_io *io[] = {
+		jack_io, pulse_io, miniaudio_io, sdl_audio_io,
+		dummy_io, null_io, file_audio_io,
+	};
+	const char *name = audio->config.backend;
+	size_t i;
+
+	/* the requested backend, or the first available one */
+	for (i = 0; i < ARRAY_LEN(io) && !audio_io; i++)
+		if (io[i] && (!name || strcmp(name, io[i]->name) == 0))
+			audio_io = io[i];
 	if (!audio_io)
-		audio_io = dummy_io;
+		die("audio: no %s backend\n", name);
 
 	audio_io->init(audio);
+
+	if (pthread_mutex_init(&audio->lock, NULL))
+		die("pthread_mutex_init() error\n");
+	audio->quit = 0;
+	if (pthread_create(&audio->thread, NULL, audio_thread, audio))
+		die("audio: pthread_create failed\n");
+	audio->running = 1;
 }
 
 void
 audio_fini(struct audio_state *audio)
 {
+	if (audio->running) {
+		audio->quit = 1;
+		pthread_join(audio->thread, NULL);
+		pthread_mutex_destroy(&audio->lock);
+		audio->running = 0;
+	}
+
 	audio_io->fini(audio);
+	printf("audio %s: %lu underruns\n", audio_io->name, audio->underruns);
+	if (audio->render_time > 0)
+		printf("audio %s: %lu frames mixed in %.3f s, %.0f frames/s, %.1fx realtime\n",
+		       audio_io->name, audio->frames, audio->render_time,
+		       audio->frames / audio->render_time,
+		       audio->frames / audio->render_time / audio->config.samplerate);
 
-	free(audio->buffer.base);
+	if (audio->buffer.mirrored)
+		xvunmirror(audio->buffer.base, audio->buffer.nmem * audio->buffer.size);
+	else
+		free(audio->buffer.base);
 }
 
 void
@@ -113,3 +322,26 @@ audio_step(struct audio_state *audio)
 {
 	audio_io->step(audio);
 }
+
+void
+audio_set_render(struct audio_state *audio, audio_render_t *render, void *data)
+{
+	audio_lock(audio);
+	audio->render = render;
+	audio->data = data;
+	audio_unlock(audio);
+}
+
+void
+audio_lock(struct audio_state *audio)
+{
+	if (audio->running)
+		pthread_mutex_lock(&audio->lock);
+}
+
+void
+audio_unlock(struct audio_state *audio)
+{
+	if (audio->running)
+		pthread_mutex_unlock(&audio->lock);
+}
@@ -1,5 +1,12 @@
+#include <pthread.h>
+
 #include "../engine/ring_buffer.h"
 
+/* The audio thread renders the mix in blocks of AUDIO_BLOCK_SIZE frames,
+ * as long as there is room in the ring buffer, and the backend consumes
+ * the ring at its own pace. */
+#define AUDIO_BLOCK_SIZE 256
+
 enum audio_format {
 	AUDIO_FORMAT_U8,
 	AUDIO_FORMAT_S16,
@@ -10,12 +17,30 @@ struct audio_config {
 	enum audio_format format;
 	unsigned int channels;
 	unsigned int samplerate;
+	double latency; /* target in seconds, 0 for the backend default */
+	const char *backend; /* by name, NULL for the first available one */
+	const char *output; /* wav file written by the file backend */
 };
 
+/* render frames of audio into buffer, called from the audio thread */
+typedef void (audio_render_t)(void *data, void *buffer, size_t frames);
+
 struct audio_state {
 	struct audio_config config;
 	struct ring_buffer buffer;
 	void *priv;
+	/* counted by the backend each time it runs out of frames */
+	volatile unsigned long underruns;
+	/* mixed by the audio thread, and the time spent doing so */
+	unsigned long frames;
+	double render_time;
+
+	pthread_t thread;
+	pthread_mutex_t lock; /* held while rendering */
+	volatile int quit;
+	int running;
+	audio_render_t *render;
+	void *data;
 };
 
 typedef void (audio_init_t)(struct audio_state *);
@@ -23,6 +48,8 @@ typedef void (audio_fini_t)(struct audio_state *);
 typedef void (audio_step_t)(struct audio_state *);
 
 struct audio_io {
+	const char *name;
+	int offline; /* consumes the frames as fast as they are mixed */
 	audio_init_t *init;
 	audio_fini_t *fini;
 	audio_step_t *step;
@@ -32,3 +59,10 @@ struct audio_state audio_create(struct audio_config);
 void audio_init(struct audio_state *);
 void audio_fini(struct audio_state *);
 void audio_step(struct audio_state *);
+
+/* set the render callback, NULL renders silence */
+void audio_set_render(struct audio_state *, audio_render_t *render, void *data);
+/* keep the audio thread from rendering, eg. while the code it calls is
+ * being reloaded */
+void audio_lock(struct audio_state *);
+void audio_unlock(struct audio_state *);
@@ -17,20 +17,25 @@ sdl_audio_callback(void *userdata, uint8_t *stream, int size)
 	size_t count;
 	float *data;
 
-	count = ring_buffer_read_size(&audio->buffer);
-	data  = ring_buffer_read_addr(&audio->buffer);
-
 	frames = size / (channels * sizeof(float));
-	count = MIN(count, frames);
-	if (count > 0) {
+	/* a single copy when the ring is mirrored, two around the wrap
+	 * otherwise */
+	while (frames > 0) {
+		count = ring_buffer_read_size(&audio->buffer);
+		data  = ring_buffer_read_addr(&audio->buffer);
+		count = MIN(count, frames);
+		if (count == 0)
+			break;
 		memcpy(stream, data, count * channels * sizeof(float));
 		ring_buffer_read_done(&audio->buffer, count);
 
 		stream += count * channels * sizeof(float);
 		frames -= count;
 	}
-	if (frames > 0)
+	if (frames > 0) {
 		memset(stream, 0, frames * channels * sizeof(float));
+		audio->underruns++;
+	}
 }
 
 static void
@@ -54,6 +59,8 @@ sdl_audio_init(struct audio_state *audio)
 
 	if (device == 0)
 		die("Failed to open an audio device\n");
+	/* the device may run at another rate, the mixer converts to it */
+	audio->config.samplerate = spec.freq;
 
 	SDL_PauseAudioDevice(device, 0);
 }
@@ -75,6 +82,7 @@ sdl_audio_step(struct audio_state *audio)
 }
 
 struct audio_io *sdl_audio_io = &(struct audio_io) {
+	.name = "sdl",
 	.init = sdl_audio_init,
 	.fini = sdl_audio_fini,
 	.step = sdl_audio_step,
@@ -1,11 +1,32 @@
+#ifdef __linux__
+#define _GNU_SOURCE /* memfd_create */
+#endif
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdatomic.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifndef WINDOWS
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sys/inotify.h>
+#endif
 #include "plat/core.h"
 
+/* file system calls made so far, by any thread */
+static atomic_ulong file_call_count;
+
+static void
+file_call(unsigned long count)
+{
+	atomic_fetch_add_explicit(&file_call_count, count, memory_order_relaxed);
+}
+
 void *
 xvmalloc(void *base, size_t align, size_t size)
 {
@@ -20,6 +41,56 @@ xvmalloc(void *base, size_t align, size_t size)
 	return addr;
 }
 
+void *
+xvmirror(size_t size)
+{
+#ifdef __linux__
+	void *addr, *lo, *hi;
+	int fd;
+
+	if (size == 0 || size % sysconf(_SC_PAGESIZE))
+		return NULL;
+
+	fd = memfd_create("mirror", MFD_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	/* reserve both halves at once, then map the same pages over each */
+	addr = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	lo = mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+	hi = mmap((char *)addr + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+	close(fd);
+	if (lo == MAP_FAILED || hi == MAP_FAILED) {
+		munmap(addr, 2 * size);
+		return NULL;
+	}
+
+	return addr;
+#else
+	UNUSED(size);
+	return NULL;
+#endif
+}
+
+void
+xvunmirror(void *addr, size_t size)
+{
+#ifdef __linux__
+	munmap(addr, 2 * size);
+#else
+	UNUSED(addr);
+	UNUSED(size);
+#endif
+}
+
 int64_t
 file_size(const char *path)
 {
@@ -29,10 +100,12 @@ file_size(const char *path)
 	f = fopen(path, "r");
 	if (f == NULL) {
 		size = -1;
+		file_call(1);
 	} else {
 		fseek(f, 0, SEEK_END);
 		size = ftell(f);
 		fclose(f);
+		file_call(3); /* open, seek, close */
 	}
 
 	return size;
@@ -49,22 +122,296 @@ file_read(const char *path, void *buf, size_t size)
 		if (f == NULL) {
 			fprintf(stderr, "fail to load '%s'\n", path);
 			ret = -1;
+			file_call(1);
 		} else {
 			ret = fread(buf, sizeof(char), size, f);
 			fclose(f);
+			file_call(3); /* open, read, close */
 		}
 	}
 
 	return ret;
 }
 
+int64_t
+file_write(const char *path, const void *buf, size_t size)
+{
+	int64_t ret = -1;
+	FILE *f;
+
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "fail to write '%s'\n", path);
+	} else {
+		ret = fwrite(buf, sizeof(char), size, f);
+		if (fclose(f))
+			ret = -1;
+	}
+	file_call(f ? 3 : 1); /* open, write, close */
+
+	return ret;
+}
+
+/* map a whole file read only, return NULL if mapping is not available */
+void *
+file_map(const char *path, size_t *size)
+{
+	void *addr = NULL;
+#ifndef WINDOWS
+	struct stat sb;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	file_call(1);
+	if (fd < 0)
+		return NULL;
+	file_call(3); /* stat, mmap, close */
+	if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+		addr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED)
+			addr = NULL;
+		else
+			*size = sb.st_size;
+	}
+	close(fd);
+#else
+	UNUSED(path);
+	UNUSED(size);
+#endif
+	return addr;
+}
+
+void
+file_unmap(void *addr, size_t size)
+{
+#ifndef WINDOWS
+	munmap(addr, size);
+	file_call(1);
+#else
+	UNUSED(addr);
+	UNUSED(size);
+#endif
+}
+
 time_t
 file_time(const char *path)
 {
 #ifndef WINDOWS
 	struct stat sb;
+	file_call(1);
 	if (stat(path, &sb) == 0)
 		return sb.st_ctime;
 #endif
 	return 0;
 }
+
+unsigned long
+file_calls(void)
+{
+	return atomic_load_explicit(&file_call_count, memory_order_relaxed);
+}
+
+/* Watched files. On Linux a thread blocks on inotify and flags the
+ * entries as their files change, the game thread only looks at the flags:
+ * when nothing changed, no system call is made. Elsewhere the files are
+ * polled with stat, at most every FILE_POLL_PERIOD. The entries are never
+ * removed and keep a copy of the path, the game library may be reloaded. */
+#define FILE_WATCH_MAX  64
+#define FILE_POLL_PERIOD 0.5 /* seconds */
+
+struct file_watch {
+	char path[256];
+	const char *name; /* in path, after the directory */
+	int wd;
+	time_t time; /* polled only */
+	atomic_int changed;
+};
+
+static struct {
+	struct file_watch entry[FILE_WATCH_MAX];
+	unsigned int count;
+	atomic_int pending; /* some entry may have changed */
+	double last_poll;
+#ifdef __linux__
+	pthread_mutex_t lock; /* count and wd, against the watcher thread */
+	pthread_t thread;
+	int fd; /* inotify, 0 before the first watch, -1 to poll */
+#endif
+} watch = {
+#ifdef __linux__
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+#ifdef __linux__
+static void *
+file_watch_thread(void *arg)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	struct file_watch *w;
+	unsigned int i;
+	ssize_t len;
+	char *p;
+	UNUSED(arg);
+
+	for (;;) {
+		len = read(watch.fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		pthread_mutex_lock(&watch.lock);
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *) p;
+			for (i = 0; i < watch.count; i++) {
+				w = &watch.entry[i];
+				if (w->wd == ev->wd && ev->len && strcmp(w->name, ev->name) == 0)
+					atomic_store_explicit(&w->changed, 1, memory_order_relaxed);
+			}
+		}
+		pthread_mutex_unlock(&watch.lock);
+		atomic_store_explicit(&watch.pending, 1, memory_order_release);
+	}
+
+	fprintf(stderr, "file_watch: %s\n", len < 0 ? strerror(errno) : "inotify closed");
+	return NULL;
+}
+
+/* watch the directory rather than the file: editors often save to a new
+ * file renamed over the old one, a watch on the old inode would be lost */
+static int
+file_watch_inotify(struct file_watch *w)
+{
+	char dir[sizeof(w->path)];
+	size_t len = w->name - w->path;
+
+	if (watch.fd == 0) {
+		watch.fd = inotify_init1(IN_CLOEXEC);
+		file_call(1);
+		if (watch.fd >= 0 && pthread_create(&watch.thread, NULL, file_watch_thread, NULL)) {
+			close(watch.fd);
+			watch.fd = -1;
+		}
+		if (watch.fd < 0) {
+			fprintf(stderr, "file_watch: inotify not available, polling\n");
+			watch.fd = -1;
+		} else {
+			pthread_detach(watch.thread);
+		}
+	}
+	if (watch.fd < 0)
+		return -1;
+
+	if (len == 0) {
+		strcpy(dir, ".");
+	} else {
+		memcpy(dir, w->path, len - 1);
+		dir[len - 1] = '\0';
+	}
+	w->wd = inotify_add_watch(watch.fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB);
+	file_call(1);
+	if (w->wd < 0)
+		fprintf(stderr, "file_watch: %s: %s\n", dir, strerror(errno));
+
+	return w->wd;
+}
+#endif
+
+static double
+file_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+file_watch(const char *path)
+{
+	struct file_watch *w;
+	const char *slash;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < watch.count; i++)
+		if (strcmp(watch.entry[i].path, path) == 0)
+			return 0;
+	if (watch.count == FILE_WATCH_MAX || strlen(path) >= sizeof(w->path))
+		return -1;
+
+	w = &watch.entry[watch.count];
+	strcpy(w->path, path);
+	slash = strrchr(w->path, '/');
+	w->name = slash ? slash + 1 : w->path;
+	w->wd = -1;
+	atomic_init(&w->changed, 0);
+
+#ifdef __linux__
+	pthread_mutex_lock(&watch.lock);
+	if (file_watch_inotify(w) < 0 && watch.fd >= 0)
+		ret = -1; /* inotify works, only not for this directory */
+	else
+		watch.count++;
+	pthread_mutex_unlock(&watch.lock);
+	if (ret < 0 || watch.fd >= 0)
+		return ret;
+#else
+	watch.count++;
+#endif
+	w->time = file_time(path);
+
+	return ret;
+}
+
+static void
+file_poll(void)
+{
+	struct file_watch *w;
+	unsigned int i;
+	double now = file_clock();
+	time_t time;
+
+	if (now - watch.last_poll < FILE_POLL_PERIOD)
+		return;
+	watch.last_poll = now;
+
+	for (i = 0; i < watch.count; i++) {
+		w = &watch.entry[i];
+		time = file_time(w->path);
+		if (time != w->time) {
+			w->time = time;
+			atomic_store_explicit(&w->changed, 1, memory_order_relaxed);
+			atomic_store_explicit(&watch.pending, 1, memory_order_relaxed);
+		}
+	}
+}
+
+const char *
+file_changed(void)
+{
+	struct file_watch *w;
+	unsigned int i;
+
+#ifdef __linux__
+	if (watch.fd < 0)
+#endif
+		file_poll();
+
+	/* cleared first, a flag set during the scan raises it again */
+	if (!atomic_exchange_explicit(&watch.pending, 0, memory_order_acquire))
+		return NULL;
+
+	for (i = 0; i < watch.count; i++) {
+		w = &watch.entry[i];
+		if (atomic_exchange_explicit(&w->changed, 0, memory_order_relaxed)) {
+			/* more entries may be flagged, look again next call */
+			atomic_store_explicit(&watch.pending, 1, memory_order_relaxed);
+			return w->path;
+		}
+	}
+
+	return NULL;
+}
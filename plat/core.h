@@ -9,8 +9,22 @@
 #define UNUSED(arg) ((void)arg)
 
 void *xvmalloc(void *base, size_t align, size_t size);
+/* map size bytes twice back to back: addr[i] and addr[size + i] are the
+ * same memory, size must be a multiple of the page size.
+ * Return NULL when not supported. */
+void *xvmirror(size_t size);
+void xvunmirror(void *addr, size_t size);
 int64_t file_size(const char *path);
 int64_t file_read(const char *path, void *buf, size_t size);
+int64_t file_write(const char *path, const void *buf, size_t size);
+void *file_map(const char *path, size_t *size);
+void file_unmap(void *addr, size_t size);
 time_t file_time(const char *path);
+/* file system calls made by the functions above, from any thread */
+unsigned long file_calls(void);
+/* Watch path for changes, return -1 if it cannot be. Each watched path
+ * that changed is returned once by file_changed, NULL when none did. */
+int file_watch(const char *path);
+const char *file_changed(void);
 
 #endif
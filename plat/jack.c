@@ -7,53 +7,56 @@ jack_client_t *jack;
 jack_port_t *outL_port;
 jack_port_t *outR_port;
 
-static int  jack_proc(jack_nframes_t nframes, void *arg);
-static void jack_init(struct ring_buffer *ring_buffer);
-static void jack_fini(void);
-
 static int
 jack_proc(jack_nframes_t nframes, void *arg)
 {
 	jack_default_audio_sample_t *outL, *outR;
-	struct ring_buffer *ring_buffer = arg;
-	size_t count = ring_buffer_read_size(ring_buffer);
+	struct audio_state *audio = arg;
+	struct sample {
+		float l;
+		float r;
+	} *data;
+	size_t count, i;
 
 	outL = jack_port_get_buffer(outL_port, nframes);
 	outR = jack_port_get_buffer(outR_port, nframes);
 
-	memset(outL, 0, nframes * sizeof(float));
-	memset(outR, 0, nframes * sizeof(float));
-
-	if (count > nframes)
-		count = nframes;
-	if (count > 0) {
-		float *audio = ring_buffer_read_addr(ring_buffer);
-		memcpy(outL, audio, count * sizeof(float));
-		memcpy(outR, audio, count * sizeof(float));
-		ring_buffer_read_done(ring_buffer, count);
+	while (nframes > 0) {
+		count = ring_buffer_read_size(&audio->buffer);
+		count = MIN(count, nframes);
+		if (count == 0) {
+			memset(outL, 0, nframes * sizeof(float));
+			memset(outR, 0, nframes * sizeof(float));
+			audio->underruns++;
+			break;
+		}
+		/* the ring holds interleaved stereo frames */
+		data = ring_buffer_read_addr(&audio->buffer);
+		for (i = 0; i < count; i++) {
+			outL[i] = data[i].l;
+			outR[i] = data[i].r;
+		}
+		ring_buffer_read_done(&audio->buffer, count);
+		outL += count;
+		outR += count;
+		nframes -= count;
 	}
 
 	return 0;
 }
 
 static void
-jack_fini(void)
+jack_fini(struct audio_state *audio)
 {
+	UNUSED(audio);
 	jack_deactivate(jack);
 	jack_client_close(jack);
 }
 
 static void
-jack_init(struct ring_buffer *ring_buffer)
+jack_init(struct audio_state *audio)
 {
-	const size_t nb_channel = 1;
 	const char **ports;
-	size_t buffersize; /* In samples */
-	size_t samplerate;
-	size_t buffer_count;
-	size_t audio_size; /* In samples */
-	void *audio_base;
-	double min_fps;
 	int ret;
 
 	/* TODO: replace JackNullOption with JackNoStartServer */
@@ -61,23 +64,11 @@ jack_init(struct ring_buffer *ring_buffer)
 	if (!jack)
 		die("jack client open failed\n");
 
-	/* Audio buffer size in samples */
-	buffersize = jack_get_buffer_size(jack);
-	samplerate = jack_get_sample_rate(jack);
-	min_fps = 30.0;
-
-	/* Ring size in nb of audio buffers */
-	#if 0
-	buffer_count = 0.5 + 2 * (1.0 / min_fps) * (samplerate / (double)buffersize);
-	#else
-	buffer_count = 4;
-	#endif
-	audio_size = buffer_count * buffersize * nb_channel;
-	audio_base = xvmalloc(NULL, 0, audio_size * sizeof(float));
-	*ring_buffer = ring_buffer_init(audio_base, audio_size, sizeof(float));
+	/* jack imposes its rate, the mixer converts to it */
+	audio->config.samplerate = jack_get_sample_rate(jack);
 
 	/* /!\ set callback AFTER initializing the ringbuffer */
-	ret = jack_set_process_callback(jack, jack_proc, ring_buffer);
+	ret = jack_set_process_callback(jack, jack_proc, audio);
 	if (ret)
 		die("jack set process callback failed \n");
 
@@ -108,11 +99,13 @@ jack_init(struct ring_buffer *ring_buffer)
 }
 
 static void
-jack_step(void)
+jack_step(struct audio_state *audio)
 {
+	UNUSED(audio);
 }
 
 struct audio_io *jack_io = &(struct audio_io) {
+	.name = "jack",
 	.init = jack_init,
 	.fini = jack_fini,
 	.step = jack_step,
@@ -34,6 +34,7 @@ miniaudio_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uin
 			frameCount -= count;
 		} else {
 			/* no more audio to write */
+			audio->underruns++;
 			ma_event_wait(&cond);
 		}
 	}
@@ -58,6 +59,9 @@ miniaudio_init(struct audio_state *audio)
 		die("Failed to initialize miniaudio\n");
         }
 
+	/* the mixer converts to the device rate */
+	audio->config.samplerate = device.sampleRate;
+
 	if (ma_event_init(&cond) != MA_SUCCESS)
 		die("ma_event_init() error");
 	quit = 0;
@@ -82,6 +86,7 @@ miniaudio_step(struct audio_state *audio)
 }
 
 struct audio_io *miniaudio_io = &(struct audio_io) {
+	.name = "miniaudio",
 	.init = miniaudio_init,
 	.fini = miniaudio_fini,
 	.step = miniaudio_step,
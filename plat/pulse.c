@@ -1,7 +1,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <pulse/pulseaudio.h>
-#include <pthread.h>
+#include <time.h>
 
 /* https://docs.huihoo.com/maemo/5.0/pulseaudio/paplay_8c-example.html */
 /* https://gavv.github.io/articles/pulseaudio-under-the-hood/#about-pulseaudio */
@@ -11,52 +11,90 @@
 #include "core.h"
 #include "audio.h"
 
+static pa_threaded_mainloop *mainloop = NULL;
 static pa_context *context = NULL;
 static pa_stream *stream = NULL;
 static pa_volume_t volume = PA_VOLUME_NORM;
+static double latency = 0.050; /* target, in seconds */
 
+/* the ring holds float frames, they are copied as is */
 static pa_sample_spec sample_spec = {
-	.format = PA_SAMPLE_S16LE,
+	.format = PA_SAMPLE_FLOAT32NE,
 	.rate = 48000,
 	.channels = 2,
 };
 
-static pthread_mutex_t mutex;
-static pthread_cond_t cond;
-static volatile int quit;
-struct sample {
-	float l;
-	float r;
-};
+/* write callback metrics, only touched by the mainloop thread */
+static struct {
+	unsigned long calls;
+	unsigned long frames;
+	double time, max_time; /* in seconds */
+} stats;
+
+static double
+pulse_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-static void stream_write_callback(pa_stream *s, size_t nframes, void *userdata)
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Called from the mainloop thread when the server wants nbytes more.
+ * Never blocks: the buffer is filled straight from the ring and padded
+ * with silence if the ring runs dry. */
+static void stream_write_callback(pa_stream *s, size_t nbytes, void *userdata)
 {
 	struct audio_state *audio = userdata;
-	size_t k = pa_frame_size(&sample_spec);
-	int16_t buf[sample_spec.channels *  512];
-	size_t count, i;
-	struct sample *data;
-
-	while (nframes > 0) {
-		count = ring_buffer_read_size(&audio->buffer);
-		data = ring_buffer_read_addr(&audio->buffer);
-		if (count > 0) {
-			count = MIN(count, 512);
+	size_t frame = pa_frame_size(&sample_spec);
+	size_t nframes, count, written = 0;
+	double start = pulse_time();
+	void *buf;
+	char *dst;
+	size_t size;
+
+	while (nbytes >= frame) {
+		/* write in place, into the server memory block */
+		size = nbytes;
+		if (pa_stream_begin_write(s, &buf, &size) < 0 || !buf)
+			break;
+		size -= size % frame;
+		if (size == 0) {
+			pa_stream_cancel_write(s);
+			break;
+		}
+
+		dst = buf;
+		nframes = size / frame;
+		while (nframes > 0) {
+			count = ring_buffer_read_size(&audio->buffer);
 			count = MIN(count, nframes);
-			for (i = 0; i < count; i++) {
-				buf[i * 2 + 0] = INT16_MAX * data[i].l;
-				buf[i * 2 + 1] = INT16_MAX * data[i].r;
-			}
-			pa_stream_write(s, buf, k * count, NULL, 0, PA_SEEK_RELATIVE);
+			if (count == 0)
+				break;
+			memcpy(dst, ring_buffer_read_addr(&audio->buffer), count * frame);
 			ring_buffer_read_done(&audio->buffer, count);
+			dst += count * frame;
 			nframes -= count;
-		} else {
-			/* no more audio to write to pulseaudio server */
-			pthread_cond_wait(&cond, &mutex);
-			if (quit)
-				return;
+			written += count;
 		}
+		if (nframes > 0) {
+			/* no more audio, keep the stream going with silence */
+			memset(dst, 0, nframes * frame);
+			audio->underruns++;
+		}
+
+		pa_stream_write(s, buf, size, NULL, 0, PA_SEEK_RELATIVE);
+		nbytes -= size;
+		if (nframes > 0)
+			break;
 	}
+
+	start = pulse_time() - start;
+	stats.calls++;
+	stats.frames += written;
+	stats.time += start;
+	stats.max_time = MAX(stats.max_time, start);
 }
 
 /* This routine is called whenever the stream state changes */
@@ -103,14 +141,15 @@ static void context_state_callback(pa_context *c, void *userdata)
 		attr.maxlength = -1;
 
 		/* tlength: target length aka latency */
-		/* latency * frame_per_sec * sizeof_frame */
-		attr.tlength = 0.050 * 48000 * 2 * sizeof(int16_t);
+		attr.tlength = pa_usec_to_bytes(latency * PA_USEC_PER_SEC, &sample_spec);
 		attr.prebuf = -1; /* pre-buffering */
-		attr.minreq = -1;//512 * sizeof(int16_t);
+		/* ask for more about four times per target length */
+		attr.minreq = attr.tlength / 4;
 
 		pa_stream_set_state_callback(stream, stream_state_callback, NULL);
 		pa_stream_set_write_callback(stream, stream_write_callback, userdata);
-		pa_stream_connect_playback(stream, dev, &attr, 0, pa_cvolume_set(&cv, sample_spec.channels, volume), NULL);
+		pa_stream_connect_playback(stream, dev, &attr, PA_STREAM_ADJUST_LATENCY,
+					   pa_cvolume_set(&cv, sample_spec.channels, volume), NULL);
 
 		break;
 	case PA_CONTEXT_TERMINATED:
@@ -124,53 +163,37 @@ static void context_state_callback(pa_context *c, void *userdata)
 	}
 }
 
-static void *
-pulse_main(void *arg)
-{
-	pa_mainloop *mainloop = arg;
-	int ret;
-
-	if (pa_mainloop_run(mainloop, &ret) < 0) {
-		fprintf(stderr, "pa_mainloop_run() failed\n");
-	}
-	fprintf(stderr, "pulse exit\n");
-
-	return NULL;
-}
-
-pthread_t pulse_thread;
-pa_mainloop *mainloop;
-
 static void
 pulse_step(struct audio_state *audio)
 {
+	/* nothing to do, the write callback pulls from the ring */
 	UNUSED(audio);
-	/* signal audio thread */
-	pthread_cond_signal(&cond);
 }
 
 static void
 pulse_init(struct audio_state *audio)
 {
-	int ret;
 	char *client_name = "drone";
 	char *server_name = NULL;
 
-	/* Set up a new main loop */
-	mainloop = pa_mainloop_new();
+	/* the server converts from any rate, ask for the configured one */
+	sample_spec.rate = audio->config.samplerate;
+	sample_spec.channels = audio->config.channels;
+	if (audio->config.latency > 0)
+		latency = audio->config.latency;
+
+	/* Set up a main loop running in its own thread */
+	mainloop = pa_threaded_mainloop_new();
 	if (!mainloop) {
-		fprintf(stderr, "pa_mainloop_new() failed\n");
-		goto quit;
+		fprintf(stderr, "pa_threaded_mainloop_new() failed\n");
+		return;
 	}
 
-	static pa_mainloop_api *mainloop_api = NULL;
-	mainloop_api = pa_mainloop_get_api(mainloop);
-
 	/* Create a new connection context */
-	context = pa_context_new(mainloop_api, client_name);
+	context = pa_context_new(pa_threaded_mainloop_get_api(mainloop), client_name);
 	if (!context) {
 		fprintf(stderr, "pa_context_new() failed\n");
-		goto quit;
+		return;
 	}
 
 	pa_context_set_state_callback(context, context_state_callback, audio);
@@ -178,48 +201,46 @@ pulse_init(struct audio_state *audio)
 	/* Connect the context */
 	if (pa_context_connect(context, server_name, 0, NULL) < 0) {
 		fprintf(stderr, "pa_context_connect() failed: %s\n", pa_strerror(pa_context_errno(context)));
-		goto quit;
+		return;
 	}
 
-	if (pthread_mutex_init(&mutex, NULL) != 0)
-		die("pthread_mutex_init() error");
-
-	if (pthread_cond_init(&cond, NULL) != 0)
-		die("pthread_cond_init() error");
-
 	/* Run the main loop */
-	ret = pthread_create(&pulse_thread, NULL, pulse_main, mainloop);
-	if (ret)
-		die("pthread_create failed\n");
-	quit = 0;
-quit:
-	return;
+	if (pa_threaded_mainloop_start(mainloop) < 0)
+		die("pa_threaded_mainloop_start() failed\n");
 }
 
 static void
 pulse_fini(struct audio_state *audio)
 {
 	UNUSED(audio);
-	quit = 1;
-	if (mainloop) {
-		pa_mainloop_quit(mainloop, 0);
-		pthread_cond_signal(&cond);
-	}
+
+	if (mainloop)
+		pa_threaded_mainloop_lock(mainloop);
 	if (stream) {
 		pa_stream_disconnect(stream);
 		pa_stream_unref(stream);
+		stream = NULL;
 	}
 	if (context) {
 		pa_context_disconnect(context);
 		pa_context_unref(context);
+		context = NULL;
 	}
-	if (mainloop)
-		pa_mainloop_free(mainloop);
-	if (pulse_thread)
-		pthread_join(pulse_thread, NULL);
+	if (mainloop) {
+		pa_threaded_mainloop_unlock(mainloop);
+		pa_threaded_mainloop_stop(mainloop);
+		pa_threaded_mainloop_free(mainloop);
+		mainloop = NULL;
+	}
+
+	if (stats.calls > 0)
+		printf("pulse: %lu write callbacks, %.1f frames and %.1f us per call, %.1f us max\n",
+		       stats.calls, stats.frames / (double) stats.calls,
+		       stats.time * 1e6 / stats.calls, stats.max_time * 1e6);
 }
 
 struct audio_io *pulse_io = &(struct audio_io) {
+	.name = "pulse",
 	.init = pulse_init,
 	.fini = pulse_fini,
 	.step = pulse_step,
@@ -2,14 +2,17 @@
 in vec3 in_pos;
 in vec3 in_normal;
 in vec2 in_texcoord;
+in mat4 in_model; /* per instance */
+in vec3 in_color; /* per instance */
 out vec3 normal;
 out vec2 texcoord;
-uniform mat4 model;
+out vec3 color;
 uniform vec2 v2Resolution;
 
 void main(void)
 {
-	gl_Position = model * vec4(in_pos, 1.0);
+	gl_Position = in_model * vec4(in_pos, 1.0);
 	normal = in_normal;
 	texcoord = in_texcoord;
+	color = in_color;
 }